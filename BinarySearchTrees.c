@@ -1,31 +1,426 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/resource.h>
 
 typedef struct _btnode{
 int item;
+int count; //Copies of item held by the node. Always 1 unless the tree is a multiset
 struct _btnode *left;
 struct _btnode *right;
 struct _btnode *parent;
 } BTNode;
 
-void inOrderTreeWalk(BTNode *node);
+//Nodes are carved out of contiguous slabs instead of being malloc'd one at a time
+typedef struct _btnodeslab{
+struct _btnodeslab *next;
+int capacity;
+BTNode nodes[];
+} BTNodeSlab;
+
+typedef struct _btnodepool{
+struct _btnodeslab *slabs; //Most recently allocated slab first
+struct _btnode *freeList; //Recycled nodes, chained through their right pointer
+int used; //Number of nodes handed out from the head slab
+} BTNodePool;
+
+//Self-adjustment applied by treeFind, treeAdd and treeRemove. With SPLAY_FULL every accessed node is splayed to the
+//root, so hot keys end up near the top. SPLAY_SEMI splays on insert and delete but only semi-splays on search, which
+//halves the rotations, and so the writes, that reads cause while still pulling hot keys up
+#define SPLAY_OFF 0
+#define SPLAY_FULL 1
+#define SPLAY_SEMI 2
+
+#define CACHE_WAYS 2
+#define CACHE_LINE 64
+#define CACHE_SETS 4096 //Sets of the cache enabled by "batch -k"
+#define CACHE_SET(cache, key) (((uint32_t)(key) * 2654435761u) >> (cache)->shift)
+
+//One set of the hot-key cache. It is padded to 32 bytes so that two sets share a cache line and a probe touches one
+typedef struct _cacheset{
+int keys[CACHE_WAYS];
+int recent; //Way that was hit or filled last. A miss replaces the other one
+int pad;
+struct _btnode *nodes[CACHE_WAYS]; //NULL for an empty way
+} CacheSet;
+
+//Two-way set associative cache from keys to the nodes holding them, consulted by treeFind before it descends. Only
+//keys that are present are cached, so inserts never make an entry stale and only treeRemove has to invalidate one
+typedef struct _cache{
+struct _cacheset *sets; //Aligned to CACHE_LINE
+int size; //Number of sets, a power of two
+int shift; //The top 32 - shift bits of the hashed key select the set
+uint64_t hits;
+uint64_t misses;
+uint64_t invalidations; //Entries dropped because their node left the tree
+} Cache;
+
+typedef struct _bstree{
+struct _btnode *root;
+struct _btnodepool pool;
+int splay; //SPLAY_OFF, SPLAY_FULL or SPLAY_SEMI, chosen per tree. treeCreate starts with SPLAY_OFF
+int multiset; //Nonzero if repeated keys share one node and its count. treeCreate starts with 0
+struct _cache *cache; //Hot-key cache of treeFind, NULL unless enabled with cacheEnable
+} BSTree;
+
+//In-order cursor built on the parent pointers and treeSuccessor, so a walk takes O(1) extra space
+typedef struct _iterator{
+struct _btnode *node; //Node returned by the next call to iteratorNext, NULL once the walk is over
+} Iterator;
+
+//Cursor for finger searches and inserts, which start from the node touched last instead of the root. It only stays
+//valid while the tree is changed through it alone, and has to be initialized again after any other insert or delete
+typedef struct _finger{
+struct _bstree *tree;
+struct _btnode *node; //Node touched last, NULL if the tree was empty
+struct _btnode *next; //In-order successor of node, NULL if node holds the largest item. Only valid if known is set
+int known;
+} Finger;
+
+#define SLAB_MIN 64
+#define SLAB_MAX 65536
+
+//Operations understood by the batch engine. In the text format an operation is the opcode letter followed by its
+//integer arguments, e.g. "i 5" or "r 10 20". In the binary format it is the opcode byte followed by its arguments as
+//4-byte little-endian integers. 'i' inserts, 'd' deletes, 's' searches, 'r' lists the keys in [a, b], 'p' lists all
+typedef struct _command{
+char op;
+int a;
+int b;
+} Command;
+
+#define IO_BUFFER 65536
+
+typedef struct _reader{
+FILE *in;
+size_t pos;
+size_t len;
+unsigned char buf[IO_BUFFER];
+} Reader;
+
+typedef struct _writer{
+FILE *out;
+size_t len;
+char buf[IO_BUFFER];
+} Writer;
+
+//Generator of binary search trees specialized to one key type, value type and ordering. less(a, b) and equal(a, b) are
+//expanded in place, so every comparison is inlined and keys and values are stored by value instead of through void
+//pointers. Two predicates rather than one three-way comparison keep the search loop as short as the one of
+//iterativeTreeSearch. BST_DEFINE_TREE(Type, prefix, ...) defines the types Type and TypeNode and the functions
+//prefixCreate, prefixDestroy, prefixSearch, prefixGet, prefixPut, prefixDelete, prefixMin and prefixNext
+#define BST_DEFINE_TREE(Type, prefix, Key, Value, less, equal) \
+typedef struct _##Type##Node{                                                                                         \
+Key key;                                                                                                              \
+Value value;                                                                                                          \
+struct _##Type##Node *left;                                                                                           \
+struct _##Type##Node *right;                                                                                          \
+struct _##Type##Node *parent;                                                                                         \
+} Type##Node;                                                                                                         \
+                                                                                                                      \
+typedef struct _##Type##Slab{                                                                                         \
+struct _##Type##Slab *next;                                                                                           \
+int capacity;                                                                                                         \
+Type##Node nodes[];                                                                                                   \
+} Type##Slab;                                                                                                         \
+                                                                                                                      \
+typedef struct _##Type{                                                                                               \
+Type##Node *root;                                                                                                     \
+Type##Slab *slabs; /*Most recently allocated slab first*/                                                             \
+Type##Node *freeList; /*Recycled nodes, chained through their right pointer*/                                         \
+int used; /*Number of nodes handed out from the head slab*/                                                           \
+int count;                                                                                                            \
+} Type;                                                                                                               \
+                                                                                                                      \
+static inline Type *prefix##Create(void) {                                                                            \
+    Type *tree = malloc(sizeof(Type));                                                                                \
+    tree->root = NULL;                                                                                                \
+    tree->slabs = NULL;                                                                                               \
+    tree->freeList = NULL;                                                                                            \
+    tree->used = 0;                                                                                                   \
+    tree->count = 0;                                                                                                  \
+    return tree;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##Destroy(Type *tree) {                                                                      \
+    Type##Slab *slab, *next;                                                                                          \
+    for (slab = tree->slabs; slab != NULL; slab = next) {                                                             \
+        next = slab->next;                                                                                            \
+        free(slab);                                                                                                   \
+    }                                                                                                                 \
+    free(tree);                                                                                                       \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/*Return the node holding key, or NULL if there is none. Its value can be read and written in place*/                 \
+static inline Type##Node *prefix##Search(Type *tree, Key key) {                                                       \
+    Type##Node *node = tree->root;                                                                                    \
+    while (node != NULL && !equal(key, node->key)) {                                                                  \
+        node = less(key, node->key) ? node->left : node->right;                                                       \
+    }                                                                                                                 \
+    return node;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/*Store the value mapped to key in *value and return 1, or return 0 if key is absent*/                                \
+static inline int prefix##Get(Type *tree, Key key, Value *value) {                                                    \
+    Type##Node *node = prefix##Search(tree, key);                                                                     \
+    if (node == NULL) {                                                                                               \
+        return 0;                                                                                                     \
+    }                                                                                                                 \
+    *value = node->value;                                                                                             \
+    return 1;                                                                                                         \
+}                                                                                                                     \
+                                                                                                                      \
+static inline Type##Node *prefix##Min(Type *tree) {                                                                   \
+    Type##Node *node = tree->root;                                                                                    \
+    while (node != NULL && node->left != NULL) {                                                                      \
+        node = node->left;                                                                                            \
+    }                                                                                                                 \
+    return node;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/*In-order successor of node, or NULL after the last one*/                                                            \
+static inline Type##Node *prefix##Next(Type##Node *node) {                                                            \
+    Type##Node *parent;                                                                                               \
+    if (node->right != NULL) {                                                                                        \
+        for (node = node->right; node->left != NULL; node = node->left)                                               \
+            ;                                                                                                         \
+        return node;                                                                                                  \
+    }                                                                                                                 \
+    for (parent = node->parent; parent != NULL && node == parent->right; parent = parent->parent) {                   \
+        node = parent;                                                                                                \
+    }                                                                                                                 \
+    return parent;                                                                                                    \
+}                                                                                                                     \
+                                                                                                                      \
+/*Map key to value. Returns 1 if key was added and 0 if it was already present, in which case its value is replaced*/ \
+static inline int prefix##Put(Type *tree, Key key, Value value) {                                                     \
+    Type##Node *parent = NULL, *cur = tree->root, *node;                                                              \
+    Type##Slab *slab;                                                                                                 \
+    int goLeft = 0, capacity;                                                                                         \
+    while (cur != NULL) {                                                                                             \
+        if (equal(key, cur->key)) {                                                                                   \
+            cur->value = value;                                                                                       \
+            return 0;                                                                                                 \
+        }                                                                                                             \
+        parent = cur;                                                                                                 \
+        goLeft = less(key, cur->key);                                                                                 \
+        cur = goLeft ? cur->left : cur->right;                                                                        \
+    }                                                                                                                 \
+    if (tree->freeList != NULL) {                                                                                     \
+        node = tree->freeList;                                                                                        \
+        tree->freeList = node->right;                                                                                 \
+    } else {                                                                                                          \
+        if (tree->slabs == NULL || tree->used == tree->slabs->capacity) {                                             \
+            capacity = tree->slabs == NULL ? SLAB_MIN : tree->slabs->capacity * 2;                                    \
+            if (capacity > SLAB_MAX) {                                                                                \
+                capacity = SLAB_MAX;                                                                                  \
+            }                                                                                                         \
+            slab = malloc(sizeof(Type##Slab) + capacity * sizeof(Type##Node));                                        \
+            slab->next = tree->slabs;                                                                                 \
+            slab->capacity = capacity;                                                                                \
+            tree->slabs = slab;                                                                                       \
+            tree->used = 0;                                                                                           \
+        }                                                                                                             \
+        node = &(tree->slabs->nodes[tree->used++]);                                                                   \
+    }                                                                                                                 \
+    node->key = key;                                                                                                  \
+    node->value = value;                                                                                              \
+    node->left = NULL;                                                                                                \
+    node->right = NULL;                                                                                               \
+    node->parent = parent;                                                                                            \
+    if (parent == NULL) {                                                                                             \
+        tree->root = node;                                                                                            \
+    } else if (goLeft) {                                                                                              \
+        parent->left = node;                                                                                          \
+    } else {                                                                                                          \
+        parent->right = node;                                                                                         \
+    }                                                                                                                 \
+    tree->count++;                                                                                                    \
+    return 1;                                                                                                         \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##Transplant(Type *tree, Type##Node *old, Type##Node *node) {                                \
+    if (old->parent == NULL) {                                                                                        \
+        tree->root = node;                                                                                            \
+    } else if (old == old->parent->left) {                                                                            \
+        old->parent->left = node;                                                                                     \
+    } else {                                                                                                          \
+        old->parent->right = node;                                                                                    \
+    }                                                                                                                 \
+    if (node != NULL) {                                                                                               \
+        node->parent = old->parent;                                                                                   \
+    }                                                                                                                 \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/*Remove key and its value. Returns 1 if key was present*/                                                            \
+static inline int prefix##Delete(Type *tree, Key key) {                                                               \
+    Type##Node *node = prefix##Search(tree, key), *successor;                                                         \
+    if (node == NULL) {                                                                                               \
+        return 0;                                                                                                     \
+    }                                                                                                                 \
+    if (node->left == NULL) {                                                                                         \
+        prefix##Transplant(tree, node, node->right);                                                                  \
+    } else if (node->right == NULL) {                                                                                 \
+        prefix##Transplant(tree, node, node->left);                                                                   \
+    } else {                                                                                                          \
+        for (successor = node->right; successor->left != NULL; successor = successor->left)                           \
+            ;                                                                                                         \
+        if (successor->parent != node) {                                                                              \
+            prefix##Transplant(tree, successor, successor->right);                                                    \
+            successor->right = node->right;                                                                           \
+            successor->right->parent = successor;                                                                     \
+        }                                                                                                             \
+        prefix##Transplant(tree, node, successor);                                                                    \
+        successor->left = node->left;                                                                                 \
+        successor->left->parent = successor;                                                                          \
+    }                                                                                                                 \
+    node->right = tree->freeList;                                                                                     \
+    tree->freeList = node;                                                                                            \
+    tree->count--;                                                                                                    \
+    return 1;                                                                                                         \
+}
+
+#define LESS_NUMBER(a, b) ((a) < (b))
+#define EQUAL_NUMBER(a, b) ((a) == (b))
+#define BYTES_KEY_LENGTH 16
+#define LESS_BYTES(a, b) bytesKeyLess(&(a), &(b))
+#define EQUAL_BYTES(a, b) (memcmp((a).bytes, (b).bytes, BYTES_KEY_LENGTH) == 0)
+
+//Fixed-length byte string key, ordered like memcmp. Shorter strings are padded with zeros
+typedef struct _byteskey{
+unsigned char bytes[BYTES_KEY_LENGTH];
+} BytesKey;
+
+/*memcmp order on two keys, computed 8 bytes at a time. A call to memcmp per node would cost more than the rest of the
+search step, while the equality test compiles to plain loads with the length known*/
+static inline int bytesKeyLess(const BytesKey *a, const BytesKey *b) {
+    uint64_t x, y;
+    int i;
+    for (i = 0; i < BYTES_KEY_LENGTH; i += 8) {
+        memcpy(&x, a->bytes + i, 8);
+        memcpy(&y, b->bytes + i, 8);
+        if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            x = __builtin_bswap64(x);
+            y = __builtin_bswap64(y);
+#endif
+            return x < y;
+        }
+    }
+    return 0;
+}
+
+BST_DEFINE_TREE(Int32Map, int32Map, int32_t, int32_t, LESS_NUMBER, EQUAL_NUMBER)
+BST_DEFINE_TREE(Int64Map, int64Map, int64_t, int64_t, LESS_NUMBER, EQUAL_NUMBER)
+BST_DEFINE_TREE(UInt64Map, uInt64Map, uint64_t, uint64_t, LESS_NUMBER, EQUAL_NUMBER)
+BST_DEFINE_TREE(BytesMap, bytesMap, BytesKey, uint64_t, LESS_BYTES, EQUAL_BYTES)
+
+//Benchmarks are selected by name from the command line: ./BinarySearchTrees bench <name> [n ...]
+typedef struct _bench{
+const char *name;
+void (*run)(int n);
+int sizes[4]; //Default problem sizes, terminated by 0 when fewer than four are used
+} Bench;
+
+#define BENCH_SAMPLE_EVERY 8
+#define BENCH_LOOKUPS 1000000
+
 BTNode *treeSearch(BTNode *node, int key);
 BTNode *iterativeTreeSearch(BTNode *node, int key);
 BTNode *treeMin(BTNode *node);
 BTNode *treeMax(BTNode *node);
 BTNode *treeSuccessor(BTNode *node);
 BTNode *treePredecessor(BTNode *node);
+BTNode *treeLowerBound(BTNode *root, int key);
+BTNode *treeUpperBound(BTNode *root, int key);
+BTNode *treeFloor(BTNode *root, int key);
+BTNode *treeCeiling(BTNode *root, int key);
+int treeRangeScan(BTNode *root, int lo, int hi, int (*visit)(int key, void *context), void *context);
+int treeRangeCopy(BTNode *root, int lo, int hi, int *buffer, int capacity);
+int multisetAdd(BSTree *tree, int key);
+int multisetRemove(BSTree *tree, int key, int copies);
+int multisetCount(BSTree *tree, int key);
+int multisetRangeScan(BTNode *root, int lo, int hi, int (*visit)(int key, int count, void *context), void *context);
 void treeInsert(BTNode **root, BTNode *newNode);
 void transplant(BTNode **root, BTNode **u, BTNode **v);
 void treeDelete(BTNode **root, BTNode *node);
-void treeDeleteAll(BTNode **root);
+void rotateUp(BTNode **root, BTNode *node);
+void splay(BTNode **root, BTNode *node);
+void semiSplay(BTNode **root, BTNode *node);
+BTNode *treeFind(BSTree *tree, int key);
+void treeAdd(BSTree *tree, BTNode *node);
+void treeRemove(BSTree *tree, BTNode *node);
+void cacheEnable(BSTree *tree, int sets);
+void cacheClear(BSTree *tree);
+void cacheInvalidate(BSTree *tree, BTNode *node);
+int treeHeight(BTNode *root);
+void iteratorInit(BTNode *root, Iterator *iterator);
+int iteratorNext(Iterator *iterator, int *key);
+int treeExport(Iterator *iterator, int *buffer, int capacity);
+void fingerInit(BSTree *tree, Finger *finger);
+BTNode *fingerClimb(Finger *finger, int key, BTNode **bound, int *known);
+BTNode *fingerSearch(Finger *finger, int key);
+BTNode *fingerInsert(Finger *finger, int key);
+void insertSortedBatch(BSTree *tree, const int *keys, int n);
+BSTree *treeCreate(void);
+void treeDestroy(BSTree *tree);
+void treeClear(BSTree *tree);
+BTNode *nodeAlloc(BSTree *tree, int item);
+void nodeFree(BSTree *tree, BTNode *node);
+void treeBuildSorted(BSTree *tree, const int *keys, int n, int unique);
+BTNode *buildSubtree(BSTree *tree, const int *keys, const int *counts, int lo, int hi);
+int batchMain(int argc, char *argv[]);
+long runBatch(BSTree *tree, FILE *in, FILE *out, int binary);
+int executeCommand(BSTree *tree, const Command *command, Writer *writer);
+int readerPeek(Reader *reader);
+int readInt(Reader *reader, int *value);
+int readTextCommand(Reader *reader, Command *command);
+int readBinaryCommand(Reader *reader, Command *command);
+void writeChar(Writer *writer, char c);
+void writeInt(Writer *writer, int value);
+void writerFlush(Writer *writer);
+int writeKey(int key, void *writer);
+int writeKeyCopies(int key, int count, void *writer);
+int benchMain(int argc, char *argv[]);
+double benchNow(void);
+uint64_t benchRandom(uint64_t *state);
+int *benchKeys(const char *dist, int n, uint64_t *state);
+int *benchZipf(int n, int count, uint64_t *state);
+int benchZipfKey(int r);
+int compareDoubles(const void *a, const void *b);
+double quantile(double *samples, int count, double q);
+void benchReport(const char *dist, int n, const char *op, double elapsed, double *samples, int count, int height);
+void benchSuite(int n);
+void benchTyped(int n);
+void benchSkewed(int n);
+void benchFinger(int n);
 
-int main(){
+int main(int argc, char *argv[]){
 	int c, i;
 	c = 1;
 
-	BTNode *root, *node;
-	root = NULL;
+	BSTree *tree;
+    Command command;
+    static Writer writer;
+
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return benchMain(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "batch") == 0) {
+        return batchMain(argc - 2, argv + 2);
+    }
+    //The menu below is a front end to the same engine that runs batches, one command at a time
+    writer.out = stdout;
+    writer.len = 0;
+
+	tree = treeCreate();
 
 	printf("1: Insert an integer into the binary search tree;\n");
 	printf("2: Print the in-order treewalk of the binary search tree;\n");
@@ -36,29 +431,31 @@ int main(){
 	while (c != 0)
 	{
 		printf("Please input your choice(1/2/3/4/0): ");
-		scanf("%d", &c);
+		if (scanf("%d", &c) != 1) {
+            c = 0;
+        }
 
 		switch (c)
 		{
 		case 1:
 			printf("Input an integer that you want to insert into the Binary Search Tree: ");
 			scanf("%d", &i);
-			node = malloc(sizeof(BTNode));
-            node->item = i;
-            node->parent = NULL;
-            node->left = NULL;
-            node->right = NULL;
-            treeInsert(&root, node);
+            command.op = 'i';
+            command.a = i;
+            executeCommand(tree, &command, NULL);
 			break;
 		case 2:
 			printf("The resulting in-order treewalk of the Binary Search Tree is: \n");
-			inOrderTreeWalk(root);
-            printf("\n");
+            command.op = 'p';
+            executeCommand(tree, &command, &writer);
+            writerFlush(&writer);
 			break;
         case 3:
             printf("Input an integer that you want to search for: ");
             scanf("%d", &i);
-            if (iterativeTreeSearch(root, i)) {
+            command.op = 's';
+            command.a = i;
+            if (executeCommand(tree, &command, NULL)) {
                 printf("Integer found!\n");
             } else {
                 printf("Integer not in Binary Search Tree!\n");
@@ -67,17 +464,16 @@ int main(){
         case 4:
             printf("Input an integer that you want to remove: ");
             scanf("%d", &i);
-            if ((node = iterativeTreeSearch(root, i))) {
-                treeDelete(&root, node);
+            command.op = 'd';
+            command.a = i;
+            if (executeCommand(tree, &command, NULL)) {
                 printf("Integer successfully removed!\n");
             } else {
                 printf("Error. Integer not in Binary Search Tree!\n");
             }
             break;
 		case 0:
-			if (root != NULL) {
-                treeDeleteAll(&root);
-            }
+            treeDestroy(tree); //Drops every slab at once instead of freeing node by node
 			break;
 		default:
 			printf("Choice unknown;\n");
@@ -87,19 +483,6 @@ int main(){
 	return 0;
 }
 
-/*Print out all the item sin a binary search tree in a sorted order by a simple recursive algorithm*/
-void inOrderTreeWalk(BTNode *node) {
-    //Perform an in order tree walk by recursively traversing the tree, going left whenever possible
-    if (node != NULL) {
-        inOrderTreeWalk(node->left);
-        printf("%d ", node->item);
-        inOrderTreeWalk(node->right);
-    } else {
-        printf("Empty tree!\n");
-    }
-    return;
-}
-
 /*Given a pointer to the root of the tree and a key, return a pointer to the node with item key if one exists,
 otherwise return NULL*/
 BTNode *treeSearch(BTNode *node, int key) {
@@ -184,6 +567,134 @@ BTNode *treePredecessor(BTNode *node) {
     return predecessor;
 }
 
+/*Given a key, return a pointer to the first node in sorted order whose item is not less than key, or NULL if every item
+is less than key*/
+BTNode *treeLowerBound(BTNode *root, int key) {
+    BTNode *node = root, *bound = NULL;
+    while (node != NULL) {
+        if (node->item >= key) {
+            //node qualifies, but there may be a smaller qualifying item on its left
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the first node in sorted order whose item is greater than key, or NULL if there is
+none*/
+BTNode *treeUpperBound(BTNode *root, int key) {
+    BTNode *node = root, *bound = NULL;
+    while (node != NULL) {
+        if (node->item > key) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the node with the largest item not greater than key, or NULL if there is none*/
+BTNode *treeFloor(BTNode *root, int key) {
+    BTNode *node = root, *bound = NULL;
+    while (node != NULL) {
+        if (node->item <= key) {
+            //node qualifies, but there may be a larger qualifying item on its right
+            bound = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the node with the smallest item not less than key, or NULL if there is none. This is
+the lower bound under its usual name*/
+BTNode *treeCeiling(BTNode *root, int key) {
+    return treeLowerBound(root, key);
+}
+
+/*Call visit on every item k with lo <= k <= hi in sorted order, passing context along, and return the number of items
+visited. The scan descends once to the lower bound of lo and then follows successors, so it costs O(log n + k) rather
+than a walk of the whole tree. visit may return nonzero to end the scan early*/
+int treeRangeScan(BTNode *root, int lo, int hi, int (*visit)(int key, void *context), void *context) {
+    BTNode *node;
+    int count = 0;
+    for (node = treeLowerBound(root, lo); node != NULL && node->item <= hi;
+        node = treeSuccessor(node)) {
+        count++;
+        if (visit(node->item, context)) {
+            break;
+        }
+    }
+    return count;
+}
+
+/*Copy the items k with lo <= k <= hi into buffer in sorted order, stopping once capacity items have been copied, and
+return the number copied*/
+int treeRangeCopy(BTNode *root, int lo, int hi, int *buffer, int capacity) {
+    BTNode *node;
+    int count = 0;
+    for (node = treeLowerBound(root, lo); count < capacity && node != NULL && node->item <= hi;
+        node = treeSuccessor(node)) {
+        buffer[count++] = node->item;
+    }
+    return count;
+}
+
+/*Add one copy of key to a multiset. A key that is already present only has its count incremented, so repeated keys
+cost a search and no allocation, and never add height. Returns the number of copies of key afterwards*/
+int multisetAdd(BSTree *tree, int key) {
+    BTNode *node = treeFind(tree, key);
+    if (node != NULL) {
+        return ++(node->count);
+    }
+    treeAdd(tree, nodeAlloc(tree, key));
+    return 1;
+}
+
+/*Remove up to copies copies of key from a multiset, or every copy if copies is 0. The node itself is deleted once its
+count drops to 0. Returns the number of copies removed*/
+int multisetRemove(BSTree *tree, int key, int copies) {
+    BTNode *node = treeFind(tree, key);
+    if (node == NULL) {
+        return 0;
+    }
+    if (copies > 0 && copies < node->count) {
+        node->count -= copies;
+        return copies;
+    }
+    copies = node->count;
+    treeRemove(tree, node);
+    nodeFree(tree, node);
+    return copies;
+}
+
+/*Return the number of copies of key in the tree, 0 if it is absent*/
+int multisetCount(BSTree *tree, int key) {
+    BTNode *node = treeFind(tree, key);
+    return node == NULL ? 0 : node->count;
+}
+
+/*Like treeRangeScan, but visit is called once per distinct key with its number of copies. Returns the total number of
+copies visited*/
+int multisetRangeScan(BTNode *root, int lo, int hi, int (*visit)(int key, int count, void *context), void *context) {
+    BTNode *node;
+    int count = 0;
+    for (node = treeLowerBound(root, lo); node != NULL && node->item <= hi; node = treeSuccessor(node)) {
+        count += node->count;
+        if (visit(node->item, node->count, context)) {
+            break;
+        }
+    }
+    return count;
+}
+
 void treeInsert(BTNode **root, BTNode *newNode) {
     BTNode *parent = NULL, *cur = *root;
     //Find a suitable position to insert the node
@@ -242,13 +753,1265 @@ void treeDelete(BTNode **root, BTNode *node) {
     return;
 }
 
-void treeDeleteAll(BTNode **root) {
-	if (*root != NULL) {
-		treeDeleteAll(&((*root)->left));
-		treeDeleteAll(&((*root)->right));
-		free(*root);
-		*root = NULL;
-	}
+/*Rotate node above its parent, keeping the in-order sequence. Which way to rotate follows from which child node is*/
+void rotateUp(BTNode **root, BTNode *node) {
+    BTNode *parent = node->parent;
+    if (node == parent->left) {
+        parent->left = node->right;
+        if (node->right != NULL) {
+            node->right->parent = parent;
+        }
+        node->right = parent;
+    } else {
+        parent->right = node->left;
+        if (node->left != NULL) {
+            node->left->parent = parent;
+        }
+        node->left = parent;
+    }
+    transplant(root, &parent, &node);
+    parent->parent = node;
+    return;
+}
+
+/*Bottom-up splay: move node to the root two levels at a time. When node and its parent are children on the same side
+(zig-zig) the parent is rotated first, which is what roughly halves the depth of every node on the path*/
+void splay(BTNode **root, BTNode *node) {
+    BTNode *parent;
+    while ((parent = node->parent) != NULL) {
+        if (parent->parent == NULL) {
+            rotateUp(root, node); //zig
+        } else if ((node == parent->left) == (parent == parent->parent->left)) {
+            rotateUp(root, parent); //zig-zig
+            rotateUp(root, node);
+        } else {
+            rotateUp(root, node); //zig-zag
+            rotateUp(root, node);
+        }
+    }
+    return;
+}
+
+/*Semi-splay: the zig-zig step only rotates the parent and carries on from there, so node itself ends up about halfway
+to the root. Paths still get shorter on every access, but with about half the rotations of splay*/
+void semiSplay(BTNode **root, BTNode *node) {
+    BTNode *parent;
+    while ((parent = node->parent) != NULL) {
+        if (parent->parent == NULL) {
+            rotateUp(root, node);
+        } else if ((node == parent->left) == (parent == parent->parent->left)) {
+            rotateUp(root, parent);
+            node = parent;
+        } else {
+            rotateUp(root, node);
+            rotateUp(root, node);
+        }
+    }
+    return;
+}
+
+/*Search the tree for key, restructuring it according to its splay mode. On a miss the last node visited is splayed
+instead, so that repeated misses near the same key also get cheaper. With a hot-key cache, a cached key is returned
+without descending or splaying, and a key found by the descent replaces the least recently used way of its set*/
+BTNode *treeFind(BSTree *tree, int key) {
+    BTNode *node = tree->root, *last = NULL;
+    CacheSet *set = NULL;
+    int way;
+    if (tree->cache != NULL) {
+        set = &(tree->cache->sets[CACHE_SET(tree->cache, key)]);
+        for (way = 0; way < CACHE_WAYS; way++) {
+            if (set->nodes[way] != NULL && set->keys[way] == key) {
+                set->recent = way;
+                tree->cache->hits++;
+                return set->nodes[way];
+            }
+        }
+        tree->cache->misses++;
+    }
+    if (tree->splay == SPLAY_OFF) {
+        node = iterativeTreeSearch(node, key);
+    } else {
+        while (node != NULL && key != node->item) {
+            last = node;
+            node = key < node->item ? node->left : node->right;
+        }
+        if (node != NULL) {
+            last = node;
+        }
+        if (last != NULL) {
+            if (tree->splay == SPLAY_SEMI) {
+                semiSplay(&(tree->root), last);
+            } else {
+                splay(&(tree->root), last);
+            }
+        }
+    }
+    if (set != NULL && node != NULL) {
+        way = (set->recent + 1) % CACHE_WAYS;
+        set->keys[way] = key;
+        set->nodes[way] = node;
+        set->recent = way;
+    }
+    return node;
+}
+
+/*Insert node, then splay it to the root unless the tree is in SPLAY_OFF mode*/
+void treeAdd(BSTree *tree, BTNode *node) {
+    treeInsert(&(tree->root), node);
+    if (tree->splay != SPLAY_OFF) {
+        splay(&(tree->root), node);
+    }
+    return;
+}
+
+/*Remove node from the tree. In the splay modes node is first splayed to the root, so the successor that replaces it
+comes up from the right subtree and the nodes around it move up with it*/
+void treeRemove(BSTree *tree, BTNode *node) {
+    if (tree->cache != NULL) {
+        cacheInvalidate(tree, node);
+    }
+    if (tree->splay != SPLAY_OFF) {
+        splay(&(tree->root), node);
+    }
+    treeDelete(&(tree->root), node);
+    return;
+}
+
+/*Put a hot-key cache with the given number of sets in front of treeFind, or remove the cache if sets is 0. sets is
+rounded up to a power of two, and to at least 2 so that the sets fill whole cache lines. A previous cache is dropped
+along with its counters*/
+void cacheEnable(BSTree *tree, int sets) {
+    Cache *cache;
+    int bits = 1;
+    if (tree->cache != NULL) {
+        free(tree->cache->sets);
+        free(tree->cache);
+        tree->cache = NULL;
+    }
+    if (sets <= 0) {
+        return;
+    }
+    while ((1 << bits) < sets && bits < 30) {
+        bits++;
+    }
+    cache = malloc(sizeof(Cache));
+    cache->size = 1 << bits;
+    cache->shift = 32 - bits;
+    cache->sets = aligned_alloc(CACHE_LINE, cache->size * sizeof(CacheSet));
+    cache->hits = cache->misses = cache->invalidations = 0;
+    tree->cache = cache;
+    cacheClear(tree);
+    return;
+}
+
+/*Empty the hot-key cache, keeping its counters. treeClear calls this since it drops every node at once*/
+void cacheClear(BSTree *tree) {
+    int i, way;
+    if (tree->cache == NULL) {
+        return;
+    }
+    for (i = 0; i < tree->cache->size; i++) {
+        for (way = 0; way < CACHE_WAYS; way++) {
+            tree->cache->sets[i].nodes[way] = NULL;
+        }
+        tree->cache->sets[i].recent = 0;
+    }
+    return;
+}
+
+/*Drop the cache entry pointing to node, if there is one. Called by treeRemove. treeDelete moves the successor that
+replaces node as a whole, so the entry of the successor's key still points to the right node*/
+void cacheInvalidate(BSTree *tree, BTNode *node) {
+    CacheSet *set = &(tree->cache->sets[CACHE_SET(tree->cache, node->item)]);
+    int way;
+    for (way = 0; way < CACHE_WAYS; way++) {
+        if (set->nodes[way] == node) {
+            set->nodes[way] = NULL;
+            tree->cache->invalidations++;
+        }
+    }
+    return;
+}
+
+/*Position the iterator on the smallest item in the tree rooted at root*/
+void iteratorInit(BTNode *root, Iterator *iterator) {
+    iterator->node = root == NULL ? NULL : treeMin(root);
+    return;
+}
+
+/*Store the next item in key and advance the iterator. Returns 0 once every item has been visited*/
+int iteratorNext(Iterator *iterator, int *key) {
+    if (iterator->node == NULL) {
+        return 0;
+    }
+    *key = iterator->node->item;
+    iterator->node = treeSuccessor(iterator->node);
+    return 1;
+}
+
+/*Copy up to capacity of the next items into buffer and return how many were copied, which is less than capacity only
+once the walk is over. Calling this repeatedly streams a tree of any size through a fixed-size buffer*/
+int treeExport(Iterator *iterator, int *buffer, int capacity) {
+    int count = 0;
+    while (count < capacity && iteratorNext(iterator, &(buffer[count]))) {
+        count++;
+    }
+    return count;
+}
+
+/*Place the finger on the root of the tree*/
+void fingerInit(BSTree *tree, Finger *finger) {
+    finger->tree = tree;
+    finger->node = tree->root;
+    finger->next = NULL;
+    finger->known = 0;
+    return;
+}
+
+/*Subroutine for fingerSearch and fingerInsert. Climb from the finger through the parent pointers to the lowest node
+whose subtree holds the position of key, which is where a search from the root would pass as well, and return it. The
+climb towards larger keys stops at the first node that is a left child of a parent greater than key, and the climb
+towards smaller keys at the first right child of a parent less than key. bound is set to the smallest item above the
+returned subtree, NULL if there is none, and known to whether bound could be told. Pass NULL for both if they are not
+needed*/
+BTNode *fingerClimb(Finger *finger, int key, BTNode **bound, int *known) {
+    BTNode *node = finger->node, *parent, *above = NULL;
+    int told = 1;
+    if (node == NULL) {
+        node = finger->tree->root;
+    } else if (key >= node->item) {
+        for (parent = node->parent; parent != NULL; node = parent, parent = parent->parent) {
+            if (node == parent->left && key < parent->item) {
+                above = parent;
+                break;
+            }
+        }
+    } else {
+        for (parent = node->parent; parent != NULL; node = parent, parent = parent->parent) {
+            if (node == parent->right && key > parent->item) {
+                told = 0;
+                break;
+            }
+        }
+    }
+    if (bound != NULL) {
+        *bound = above;
+        *known = told;
+    }
+    return node;
+}
+
+/*Search for key starting from the finger and move the finger to the node found. Returns that node, or NULL if key is
+absent, in which case the finger stays where it was. Nothing is splayed, whatever the mode of the tree*/
+BTNode *fingerSearch(Finger *finger, int key) {
+    BTNode *node = finger->node;
+    if (node != NULL && key == node->item) {
+        return node;
+    }
+    if (node != NULL && finger->known && finger->next != NULL && key == finger->next->item) {
+        node = finger->next;
+    } else {
+        node = iterativeTreeSearch(fingerClimb(finger, key, NULL, NULL), key);
+        if (node == NULL) {
+            return node;
+        }
+    }
+    finger->node = node;
+    finger->known = 0;
+    return node;
+}
+
+/*Insert key starting from the finger, move the finger to the node holding it and return that node. A key that falls
+between the finger's node and its successor is linked in O(1) time, so an ascending run no longer turns every insert
+into a walk down the chain it builds. Other keys climb from the finger with fingerClimb and descend from there. In a
+multiset a key that is already present has its count incremented. Nothing is splayed, whatever the mode of the tree*/
+BTNode *fingerInsert(Finger *finger, int key) {
+    BSTree *tree = finger->tree;
+    BTNode *node = finger->node, *next, *cur, *parent, *newNode;
+    int known;
+    if (node != NULL && !finger->known) {
+        finger->next = treeSuccessor(node);
+        finger->known = 1;
+    }
+    next = finger->next;
+    known = 1;
+    if (tree->multiset && node != NULL && key == node->item) {
+        node->count++;
+        return node;
+    }
+    if (node != NULL && node->item <= key && (next == NULL || key < next->item)) {
+        //key goes right after node: into node's right child if it has none, and otherwise into the left child of next,
+        //which is then the minimum of node's right subtree
+        parent = node->right == NULL ? node : next;
+    } else {
+        parent = NULL;
+        for (cur = fingerClimb(finger, key, &next, &known); cur != NULL; ) {
+            if (tree->multiset && key == cur->item) {
+                cur->count++;
+                finger->node = cur;
+                finger->known = 0;
+                return cur;
+            }
+            parent = cur;
+            if (key < cur->item) {
+                next = cur;
+                known = 1;
+                cur = cur->left;
+            } else {
+                cur = cur->right;
+            }
+        }
+    }
+    newNode = nodeAlloc(tree, key);
+    newNode->parent = parent;
+    if (parent == NULL) {
+        tree->root = newNode;
+    } else if (key < parent->item) {
+        parent->left = newNode;
+    } else {
+        parent->right = newNode;
+    }
+    finger->node = newNode;
+    finger->next = next;
+    finger->known = known;
+    return newNode;
+}
+
+/*Insert the n keys of a sorted, or mostly sorted, array with a finger that follows the inserted keys. Each key lands
+right after the previous one, so an ascending array costs O(n) instead of the O(n^2) of treeInsert building a chain.
+Unsorted input is inserted correctly, only without the gain*/
+void insertSortedBatch(BSTree *tree, const int *keys, int n) {
+    Finger finger;
+    int i;
+    fingerInit(tree, &finger);
+    for (i = 0; i < n; i++) {
+        fingerInsert(&finger, keys[i]);
+    }
+    return;
+}
+
+/*Return the number of nodes on the longest root-to-leaf path. The walk is an in-order traversal through the parent
+pointers that tracks the depth as it goes, so it uses no stack even when the tree has degenerated into a chain*/
+int treeHeight(BTNode *root) {
+    BTNode *node = root, *child;
+    int depth = 1, height = 0;
+    if (node == NULL) {
+        return 0;
+    }
+    for (; node->left != NULL; depth++) {
+        node = node->left;
+    }
+    while (node != NULL) {
+        if (depth > height) {
+            height = depth;
+        }
+        if (node->right != NULL) {
+            //Move to the leftmost node of the right subtree
+            for (node = node->right, depth++; node->left != NULL; depth++) {
+                node = node->left;
+            }
+        } else {
+            //Climb until we arrive from a left child, the parent of which is the successor
+            do {
+                child = node;
+                node = node->parent;
+                depth--;
+            } while (node != NULL && child == node->right);
+        }
+    }
+    return height;
+}
+
+/*Create an empty binary search tree with its own node pool*/
+BSTree *treeCreate(void) {
+    BSTree *tree;
+    tree = malloc(sizeof(BSTree));
+    tree->root = NULL;
+    tree->pool.slabs = NULL;
+    tree->pool.freeList = NULL;
+    tree->pool.used = 0;
+    tree->splay = SPLAY_OFF;
+    tree->multiset = 0;
+    tree->cache = NULL;
+    return tree;
+}
+
+/*Release a binary search tree along with every node it holds. Since all nodes live in the pool's slabs, this costs
+one free per slab rather than one free per node*/
+void treeDestroy(BSTree *tree) {
+    treeClear(tree);
+    cacheEnable(tree, 0);
+    free(tree);
+    return;
+}
+
+/*Remove every node from a binary search tree by dropping the slabs of its node pool, leaving an empty tree*/
+void treeClear(BSTree *tree) {
+    BTNodeSlab *slab, *next;
+    for (slab = tree->pool.slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    tree->root = NULL;
+    tree->pool.slabs = NULL;
+    tree->pool.freeList = NULL;
+    tree->pool.used = 0;
+    cacheClear(tree);
+    return;
+}
+
+/*Hand out a node holding item, reusing a recycled node if there is one and otherwise taking the next unused node of
+the head slab. A new slab, twice as large as the previous one, is added when the head slab is full*/
+BTNode *nodeAlloc(BSTree *tree, int item) {
+    BTNodePool *pool = &(tree->pool);
+    BTNodeSlab *slab;
+    BTNode *node;
+    int capacity;
+    if (pool->freeList != NULL) {
+        node = pool->freeList;
+        pool->freeList = node->right;
+    } else {
+        if (pool->slabs == NULL || pool->used == pool->slabs->capacity) {
+            capacity = pool->slabs == NULL ? SLAB_MIN : pool->slabs->capacity * 2;
+            if (capacity > SLAB_MAX) {
+                capacity = SLAB_MAX;
+            }
+            slab = malloc(sizeof(BTNodeSlab) + capacity * sizeof(BTNode));
+            slab->next = pool->slabs;
+            slab->capacity = capacity;
+            pool->slabs = slab;
+            pool->used = 0;
+        }
+        node = &(pool->slabs->nodes[pool->used++]);
+    }
+    node->item = item;
+    node->count = 1;
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+    return node;
+}
+
+/*Return a node that is no longer linked into the tree to the pool so that the next nodeAlloc can reuse it*/
+void nodeFree(BSTree *tree, BTNode *node) {
+    node->right = tree->pool.freeList;
+    tree->pool.freeList = node;
+    return;
+}
+
+/*Given a sorted array of n keys, replace the contents of the tree with a perfectly balanced binary search tree holding
+those keys in O(n) time. If unique is nonzero, repeated keys are only stored once. Otherwise, in a multiset, each run
+of a repeated key becomes one node whose count is the length of the run*/
+void treeBuildSorted(BSTree *tree, const int *keys, int n, int unique) {
+    int *distinct = NULL, *counts = NULL;
+    int i, m;
+    treeClear(tree);
+    if ((unique || tree->multiset) && n > 0) {
+        //Compact the keys into a scratch copy so that every key is only stored once, counting the copies of each key
+        //when the tree is a multiset that keeps them
+        distinct = malloc(n * sizeof(int));
+        if (!unique) {
+            counts = malloc(n * sizeof(int));
+            counts[0] = 1;
+        }
+        distinct[0] = keys[0];
+        for (i = 1, m = 1; i < n; i++) {
+            if (keys[i] != distinct[m - 1]) {
+                if (counts != NULL) {
+                    counts[m] = 1;
+                }
+                distinct[m++] = keys[i];
+            } else if (counts != NULL) {
+                counts[m - 1]++;
+            }
+        }
+        keys = distinct;
+        n = m;
+    }
+    tree->root = buildSubtree(tree, keys, counts, 0, n - 1);
+    if (tree->root != NULL) {
+        tree->root->parent = NULL;
+    }
+    free(distinct);
+    free(counts);
+    return;
+}
+
+/*Subroutine for treeBuildSorted, which builds the subtree holding keys[lo..hi] by making the middle key the root and
+returns a pointer to that root. counts[i] is the number of copies of keys[i], or every key has one if counts is NULL*/
+BTNode *buildSubtree(BSTree *tree, const int *keys, const int *counts, int lo, int hi) {
+    BTNode *node;
+    int mid;
+    if (lo > hi) {
+        return NULL;
+    }
+    mid = lo + (hi - lo) / 2;
+    node = nodeAlloc(tree, keys[mid]);
+    node->count = counts != NULL ? counts[mid] : 1;
+    node->left = buildSubtree(tree, keys, counts, lo, mid - 1);
+    node->right = buildSubtree(tree, keys, counts, mid + 1, hi);
+    if (node->left != NULL) {
+        node->left->parent = node;
+    }
+    if (node->right != NULL) {
+        node->right->parent = node;
+    }
+    return node;
+}
+
+/*Run the batch engine with the arguments given after "batch" on the command line: an optional -b to select the binary
+format, an optional -m followed by off, splay or semi to select the splay mode of the tree, an optional -c to keep
+repeated keys as counts in a multiset, an optional -k to answer searches and deletes through a hot-key cache of
+CACHE_SETS sets, and an optional input file. Operations are read from stdin when no file is given*/
+int batchMain(int argc, char *argv[]) {
+    BSTree *tree;
+    FILE *in = stdin;
+    int binary = 0, mode = SPLAY_OFF, multiset = 0, cache = 0;
+    long executed;
+    while (argc >= 1 && argv[0][0] == '-') {
+        if (strcmp(argv[0], "-b") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[0], "-c") == 0) {
+            multiset = 1;
+        } else if (strcmp(argv[0], "-k") == 0) {
+            cache = 1;
+        } else if (strcmp(argv[0], "-m") == 0 && argc >= 2 && strcmp(argv[1], "off") == 0) {
+            mode = SPLAY_OFF;
+        } else if (strcmp(argv[0], "-m") == 0 && argc >= 2 && strcmp(argv[1], "splay") == 0) {
+            mode = SPLAY_FULL;
+        } else if (strcmp(argv[0], "-m") == 0 && argc >= 2 && strcmp(argv[1], "semi") == 0) {
+            mode = SPLAY_SEMI;
+        } else {
+            fprintf(stderr, "Usage: batch [-b] [-c] [-k] [-m off|splay|semi] [file]\n");
+            return 1;
+        }
+        if (argv[0][1] == 'm') {
+            argc--;
+            argv++;
+        }
+        argc--;
+        argv++;
+    }
+    if (argc >= 1 && (in = fopen(argv[0], binary ? "rb" : "r")) == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[0]);
+        return 1;
+    }
+    tree = treeCreate();
+    tree->splay = mode;
+    tree->multiset = multiset;
+    if (cache) {
+        cacheEnable(tree, CACHE_SETS);
+    }
+    executed = runBatch(tree, in, stdout, binary);
+    treeDestroy(tree);
+    if (in != stdin) {
+        fclose(in);
+    }
+    return executed < 0 ? 1 : 0;
+}
+
+/*Read operations from in until it is exhausted and run them back to back on the tree. All output goes through one
+large buffer that is written to out when it fills up and once at the end. Returns the number of operations run, or
+-1 if the input is malformed*/
+long runBatch(BSTree *tree, FILE *in, FILE *out, int binary) {
+    Reader *reader;
+    Writer *writer;
+    Command command;
+    long executed = 0;
+    int status;
+    reader = malloc(sizeof(Reader));
+    writer = malloc(sizeof(Writer));
+    reader->in = in;
+    reader->pos = reader->len = 0;
+    writer->out = out;
+    writer->len = 0;
+    while ((status = binary ? readBinaryCommand(reader, &command) : readTextCommand(reader, &command)) > 0) {
+        executeCommand(tree, &command, writer);
+        executed++;
+    }
+    writerFlush(writer);
+    if (status < 0) {
+        fprintf(stderr, "Malformed operation after %ld operations\n", executed);
+        executed = -1;
+    }
+    free(reader);
+    free(writer);
+    return executed;
+}
+
+/*Apply one operation to the tree and append its output, if any, to writer. Searches and deletes write 1 or 0 and
+return 1 if the key was found, range and dump write the matching keys on one line. writer may be NULL for operations
+other than range and dump, in which case only the return value reports the outcome*/
+int executeCommand(BSTree *tree, const Command *command, Writer *writer) {
+    BTNode *node;
+    Iterator iterator;
+    int found = 0, key;
+    switch (command->op) {
+    case 'i':
+        if (tree->multiset) {
+            multisetAdd(tree, command->a);
+        } else {
+            treeAdd(tree, nodeAlloc(tree, command->a));
+        }
+        return 1;
+    case 's':
+        found = treeFind(tree, command->a) != NULL;
+        if (writer != NULL) {
+            writeChar(writer, found ? '1' : '0');
+            writeChar(writer, '\n');
+        }
+        return found;
+    case 'd':
+        if (tree->multiset) {
+            found = multisetRemove(tree, command->a, 1);
+        } else if ((node = treeFind(tree, command->a)) != NULL) {
+            treeRemove(tree, node);
+            nodeFree(tree, node);
+            found = 1;
+        }
+        if (writer != NULL) {
+            writeChar(writer, found ? '1' : '0');
+            writeChar(writer, '\n');
+        }
+        return found;
+    case 'p':
+        if (tree->multiset) {
+            found = multisetRangeScan(tree->root, INT_MIN, INT_MAX, writeKeyCopies, writer);
+            writeChar(writer, '\n');
+            return found;
+        }
+        iteratorInit(tree->root, &iterator);
+        while (iteratorNext(&iterator, &key)) {
+            writeInt(writer, key);
+            writeChar(writer, ' ');
+            found++;
+        }
+        writeChar(writer, '\n');
+        return found;
+    case 'r':
+        if (tree->multiset) {
+            found = multisetRangeScan(tree->root, command->a, command->b, writeKeyCopies, writer);
+        } else {
+            found = treeRangeScan(tree->root, command->a, command->b, writeKey, writer);
+        }
+        writeChar(writer, '\n');
+        return found;
+    default:
+        return 0;
+    }
+}
+
+/*Return the next byte of input without consuming it, refilling the buffer when it runs out, or -1 at end of input*/
+int readerPeek(Reader *reader) {
+    if (reader->pos == reader->len) {
+        reader->pos = 0;
+        reader->len = fread(reader->buf, 1, IO_BUFFER, reader->in);
+        if (reader->len == 0) {
+            return -1;
+        }
+    }
+    return reader->buf[reader->pos];
+}
+
+/*Parse an optionally signed decimal integer after skipping blanks on the current line. Returns 0 if there is none or
+if it does not fit in an int*/
+int readInt(Reader *reader, int *value) {
+    int c, negative = 0, digits = 0, overflow = 0;
+    unsigned result = 0, limit;
+    while ((c = readerPeek(reader)) == ' ' || c == '\t') {
+        reader->pos++;
+    }
+    if (c == '-') {
+        negative = 1;
+        reader->pos++;
+    }
+    limit = (unsigned)INT_MAX + (unsigned)negative; //The magnitude of INT_MIN is one more than INT_MAX
+    while ((c = readerPeek(reader)) >= '0' && c <= '9') {
+        if (result > (limit - (unsigned)(c - '0')) / 10) {
+            overflow = 1; //Keep consuming the digits so the rest of the number is not read as another operand
+        } else {
+            result = result * 10 + (unsigned)(c - '0');
+        }
+        reader->pos++;
+        digits++;
+    }
+    *value = negative ? (int)(0u - result) : (int)result;
+    return digits > 0 && !overflow;
+}
+
+/*Parse the next text operation into command. Blank lines and lines starting with # are skipped. Returns 1 if an
+operation was read, 0 at end of input and -1 if the input is malformed*/
+int readTextCommand(Reader *reader, Command *command) {
+    int c;
+    for (;;) {
+        c = readerPeek(reader);
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            reader->pos++;
+        } else if (c == '#') {
+            while ((c = readerPeek(reader)) != -1 && c != '\n') {
+                reader->pos++;
+            }
+        } else {
+            break;
+        }
+    }
+    if (c == -1) {
+        return 0;
+    }
+    reader->pos++;
+    command->op = (char)c;
+    switch (c) {
+    case 'i':
+    case 'd':
+    case 's':
+        return readInt(reader, &(command->a)) ? 1 : -1;
+    case 'r':
+        return readInt(reader, &(command->a)) && readInt(reader, &(command->b)) ? 1 : -1;
+    case 'p':
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+/*Decode the next binary operation into command. Returns 1 if an operation was read, 0 at end of input and -1 if the
+input is malformed or truncated*/
+int readBinaryCommand(Reader *reader, Command *command) {
+    int c, i, j, args;
+    uint32_t value;
+    if ((c = readerPeek(reader)) == -1) {
+        return 0;
+    }
+    reader->pos++;
+    command->op = (char)c;
+    args = (c == 'r') ? 2 : (c == 'p') ? 0 : (c == 'i' || c == 'd' || c == 's') ? 1 : -1;
+    for (i = 0; i < args; i++) {
+        value = 0;
+        for (j = 0; j < 4; j++) {
+            if ((c = readerPeek(reader)) == -1) {
+                return -1;
+            }
+            reader->pos++;
+            value |= (uint32_t)c << (8 * j);
+        }
+        if (i == 0) {
+            command->a = (int)value;
+        } else {
+            command->b = (int)value;
+        }
+    }
+    return args < 0 ? -1 : 1;
+}
+
+/*Append one character to the output buffer, writing the buffer out when it is full*/
+void writeChar(Writer *writer, char c) {
+    if (writer->len == IO_BUFFER) {
+        writerFlush(writer);
+    }
+    writer->buf[writer->len++] = c;
+    return;
+}
+
+/*Append the decimal form of value to the output buffer without going through printf*/
+void writeInt(Writer *writer, int value) {
+    char digits[12];
+    int count = 0;
+    unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    if (writer->len + sizeof(digits) > IO_BUFFER) {
+        writerFlush(writer);
+    }
+    if (value < 0) {
+        writer->buf[writer->len++] = '-';
+    }
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    while (count > 0) {
+        writer->buf[writer->len++] = digits[--count];
+    }
     return;
 }
 
+/*Range scan visitor that appends key and a separating space to the Writer passed as context*/
+int writeKey(int key, void *writer) {
+    writeInt(writer, key);
+    writeChar(writer, ' ');
+    return 0;
+}
+
+/*Multiset range scan visitor that writes key once per copy, so a multiset prints the same as a tree of duplicates*/
+int writeKeyCopies(int key, int count, void *writer) {
+    while (count-- > 0) {
+        writeKey(key, writer);
+    }
+    return 0;
+}
+
+/*Write out everything in the output buffer*/
+void writerFlush(Writer *writer) {
+    fwrite(writer->buf, 1, writer->len, writer->out);
+    fflush(writer->out);
+    writer->len = 0;
+    return;
+}
+
+//Sorted and reverse-sorted keys turn the tree into a chain, which makes the suite quadratic in n
+Bench benches[] = {
+    {"suite", benchSuite, {1000, 10000, 0}},
+    {"typed", benchTyped, {100000, 1000000, 0}},
+    {"skewed", benchSkewed, {100000, 1000000, 0}},
+    {"finger", benchFinger, {1000, 10000, 0}},
+};
+
+/*Run the benchmark named by argv[0], either at the sizes given in the remaining arguments or at its default sizes.
+Every measurement is printed as one JSON object per line*/
+int benchMain(int argc, char *argv[]) {
+    int b, i, count = sizeof(benches) / sizeof(benches[0]);
+    for (b = 0; argc >= 1 && b < count; b++) {
+        if (strcmp(argv[0], benches[b].name) == 0) {
+            if (argc >= 2) {
+                for (i = 1; i < argc; i++) {
+                    benches[b].run(atoi(argv[i]));
+                }
+            } else {
+                for (i = 0; i < 4 && benches[b].sizes[i] != 0; i++) {
+                    benches[b].run(benches[b].sizes[i]);
+                }
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "Usage: bench <name> [n ...] where name is one of:");
+    for (b = 0; b < count; b++) {
+        fprintf(stderr, " %s", benches[b].name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+/*Return a monotonic timestamp in seconds*/
+double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*Return the next value of a xorshift64* generator. Benchmarks use it instead of rand() for reproducible 64-bit output*/
+uint64_t benchRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/*Return a malloc'd stream of count keys drawn from n distinct keys, the k-th most popular with probability
+proportional to 1/k. The cumulative distribution is inverted with a binary search, then the ranks are scattered with a
+multiplicative hash so that popular keys are not also the smallest ones. Rank r maps to key benchZipfKey(r)*/
+int *benchZipf(int n, int count, uint64_t *state) {
+    int *keys = malloc(count * sizeof(int));
+    double *cdf, total, u;
+    int i, lo, hi, mid;
+    cdf = malloc(n * sizeof(double));
+    for (i = 0, total = 0; i < n; i++) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+    for (i = 0; i < count; i++) {
+        u = (benchRandom(state) >> 11) * (1.0 / 9007199254740992.0) * total;
+        for (lo = 0, hi = n - 1; lo < hi; ) {
+            mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        keys[i] = benchZipfKey(lo);
+    }
+    free(cdf);
+    return keys;
+}
+
+/*Key of rank r in the streams of benchZipf*/
+int benchZipfKey(int r) {
+    return (int)(((uint32_t)r * 2654435761u) & INT_MAX);
+}
+
+/*Return a malloc'd stream of n keys following the named distribution: "sorted", "reverse", "uniform", "zipf" (n
+distinct keys with the k-th most popular drawn with probability proportional to 1/k) or "sawtooth" (interleaved
+ascending runs). Returns NULL for an unknown name*/
+int *benchKeys(const char *dist, int n, uint64_t *state) {
+    int *keys = malloc(n * sizeof(int));
+    int i, teeth;
+    if (strcmp(dist, "sorted") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = i;
+        }
+    } else if (strcmp(dist, "reverse") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = n - 1 - i;
+        }
+    } else if (strcmp(dist, "uniform") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = (int)(benchRandom(state) % INT_MAX);
+        }
+    } else if (strcmp(dist, "zipf") == 0) {
+        free(keys);
+        return benchZipf(n, n, state);
+    } else if (strcmp(dist, "sawtooth") == 0) {
+        //Key i lands in tooth i % teeth at height i / teeth, so consecutive keys climb different teeth in turn
+        for (teeth = 1; teeth * teeth < n; teeth++) {
+        }
+        for (i = 0; i < n; i++) {
+            keys[i] = (i % teeth) * ((n + teeth - 1) / teeth) + i / teeth;
+        }
+    } else {
+        free(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+/*Subroutine for quantile*/
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*Return the q-quantile of count samples, sorting the samples in place*/
+double quantile(double *samples, int count, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(samples, count, sizeof(double), compareDoubles);
+    return samples[(int)(q * (count - 1))];
+}
+
+/*Print one line of suite results. elapsed covers all n operations while samples holds the latency of every
+BENCH_SAMPLE_EVERY-th operation, so that reading the clock adds little to the average. max_depth is the height of
+the tree after all inserts and peak_rss_kb is the peak resident set of the process so far*/
+void benchReport(const char *dist, int n, const char *op, double elapsed, double *samples, int count, int height) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"bench\":\"suite\",\"tree\":\"bst\",\"dist\":\"%s\",\"n\":%d,\"op\":\"%s\",\"ns_per_op\":%.1f,"
+        "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"max_depth\":%d,\"peak_rss_kb\":%ld}\n",
+        dist, n, op, elapsed * 1e9 / n, quantile(samples, count, 0.5) * 1e9, quantile(samples, count, 0.99) * 1e9,
+        height, (long)usage.ru_maxrss);
+    return;
+}
+
+/*Run insert, search, traversal and delete over n keys from every distribution that benchKeys knows*/
+void benchSuite(int n) {
+    const char *dists[] = {"sorted", "reverse", "uniform", "zipf", "sawtooth"};
+    BSTree *tree;
+    BTNode *node;
+    uint64_t state = 88172645463325252ULL;
+    double *samples, start, t = 0, elapsed, overhead;
+    int *keys;
+    int d, i, count, height;
+
+    samples = malloc((n / BENCH_SAMPLE_EVERY + 1) * sizeof(double));
+    //The cheapest back-to-back clock reading is subtracted from every sample
+    for (i = 0, overhead = 1; i < 1000; i++) {
+        t = benchNow();
+        t = benchNow() - t;
+        overhead = t < overhead ? t : overhead;
+    }
+    for (d = 0; d < (int)(sizeof(dists) / sizeof(dists[0])); d++) {
+        keys = benchKeys(dists[d], n, &state);
+        tree = treeCreate();
+
+        count = 0;
+        start = benchNow();
+        for (i = 0; i < n; i++) {
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                t = benchNow();
+            }
+            treeInsert(&(tree->root), nodeAlloc(tree, keys[i]));
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = benchNow() - t - overhead;
+            }
+        }
+        elapsed = benchNow() - start;
+        height = treeHeight(tree->root);
+        benchReport(dists[d], n, "insert", elapsed, samples, count, height);
+
+        count = 0;
+        start = benchNow();
+        for (i = 0; i < n; i++) {
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                t = benchNow();
+            }
+            node = iterativeTreeSearch(tree->root, keys[i]);
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = benchNow() - t - overhead;
+            }
+            if (node == NULL) {
+                fprintf(stderr, "suite: key %d went missing\n", keys[i]);
+            }
+        }
+        elapsed = benchNow() - start;
+        benchReport(dists[d], n, "search", elapsed, samples, count, height);
+
+        //The whole walk is a single operation, so its only sample is the average cost per key
+        count = 0;
+        start = benchNow();
+        for (node = tree->root == NULL ? NULL : treeMin(tree->root); node != NULL; node = treeSuccessor(node)) {
+            count++;
+        }
+        elapsed = benchNow() - start;
+        if (count != n) {
+            fprintf(stderr, "suite: walked %d of %d keys\n", count, n);
+        }
+        samples[0] = elapsed / n;
+        benchReport(dists[d], n, "traverse", elapsed, samples, 1, height);
+
+        count = 0;
+        start = benchNow();
+        for (i = 0; i < n; i++) {
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                t = benchNow();
+            }
+            node = iterativeTreeSearch(tree->root, keys[i]);
+            treeDelete(&(tree->root), node);
+            nodeFree(tree, node);
+            if (i % BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = benchNow() - t - overhead;
+            }
+        }
+        elapsed = benchNow() - start;
+        benchReport(dists[d], n, "delete", elapsed, samples, count, height);
+
+        treeDestroy(tree);
+        free(keys);
+    }
+    free(samples);
+    return;
+}
+
+/*Compare lookups in the generated int32 tree against iterativeTreeSearch on the same keys and probes, and time the
+other generated instances on the same workload. Keys are inserted in random order so that both trees have the same,
+roughly balanced shape. The ratio should stay close to 1*/
+void benchTyped(int n) {
+    BSTree *tree;
+    Int32Map *int32Map;
+    Int64Map *int64Map;
+    UInt64Map *uint64Map;
+    BytesMap *bytesMap;
+    BytesKey bytesKey;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, j, tmp, round, hits;
+    double start, elapsed, plain = 0, typed = 0;
+
+    keys = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        keys[i] = 2 * i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(benchRandom(&state) % (uint64_t)(i + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    tree = treeCreate();
+    int32Map = int32MapCreate();
+    int64Map = int64MapCreate();
+    uint64Map = uInt64MapCreate();
+    bytesMap = bytesMapCreate();
+    memset(&bytesKey, 0, sizeof(BytesKey));
+    for (i = 0; i < n; i++) {
+        treeInsert(&(tree->root), nodeAlloc(tree, keys[i]));
+        int32MapPut(int32Map, keys[i], i);
+        int64MapPut(int64Map, keys[i], i);
+        uInt64MapPut(uint64Map, (uint64_t)keys[i], (uint64_t)i);
+        //Big-endian so that memcmp order agrees with the integer order
+        bytesKey.bytes[12] = (unsigned char)(keys[i] >> 24);
+        bytesKey.bytes[13] = (unsigned char)(keys[i] >> 16);
+        bytesKey.bytes[14] = (unsigned char)(keys[i] >> 8);
+        bytesKey.bytes[15] = (unsigned char)keys[i];
+        bytesMapPut(bytesMap, bytesKey, (uint64_t)i);
+    }
+    probes = malloc(BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(benchRandom(&state) % (uint64_t)(2 * n));
+    }
+
+    //Alternate the two runs a few times and keep the best of each, so that neither one is favored by a warm cache
+    for (round = 0; round < 3; round++) {
+        start = benchNow();
+        hits = 0;
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+            hits += iterativeTreeSearch(tree->root, probes[i]) != NULL;
+        }
+        elapsed = benchNow() - start;
+        plain = BENCH_LOOKUPS / elapsed > plain ? BENCH_LOOKUPS / elapsed : plain;
+
+        start = benchNow();
+        hits = 0;
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+            hits += int32MapSearch(int32Map, probes[i]) != NULL;
+        }
+        elapsed = benchNow() - start;
+        typed = BENCH_LOOKUPS / elapsed > typed ? BENCH_LOOKUPS / elapsed : typed;
+    }
+    printf("{\"bench\":\"typed\",\"tree\":\"bst\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d}\n", n, plain, hits);
+    printf("{\"bench\":\"typed\",\"tree\":\"int32\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, typed, hits, typed / plain);
+
+    start = benchNow();
+    hits = 0;
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        hits += int64MapSearch(int64Map, probes[i]) != NULL;
+    }
+    elapsed = benchNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"int64\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, BENCH_LOOKUPS / elapsed, hits, BENCH_LOOKUPS / elapsed / plain);
+
+    start = benchNow();
+    hits = 0;
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        hits += uInt64MapSearch(uint64Map, (uint64_t)probes[i]) != NULL;
+    }
+    elapsed = benchNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"uint64\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, BENCH_LOOKUPS / elapsed, hits, BENCH_LOOKUPS / elapsed / plain);
+
+    start = benchNow();
+    hits = 0;
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        bytesKey.bytes[12] = (unsigned char)(probes[i] >> 24);
+        bytesKey.bytes[13] = (unsigned char)(probes[i] >> 16);
+        bytesKey.bytes[14] = (unsigned char)(probes[i] >> 8);
+        bytesKey.bytes[15] = (unsigned char)probes[i];
+        hits += bytesMapSearch(bytesMap, bytesKey) != NULL;
+    }
+    elapsed = benchNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"bytes16\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, BENCH_LOOKUPS / elapsed, hits, BENCH_LOOKUPS / elapsed / plain);
+
+    free(keys);
+    free(probes);
+    treeDestroy(tree);
+    int32MapDestroy(int32Map);
+    int64MapDestroy(int64Map);
+    uInt64MapDestroy(uint64Map);
+    bytesMapDestroy(bytesMap);
+    return;
+}
+
+/*Zipf-distributed lookups over n keys with each splay mode. The keys are the n ranks of the stream, inserted in
+random order, so every lookup hits. "bench skewed" of RedBlackTrees runs the same workload with the same seed on the
+red-black tree, which makes the two outputs directly comparable*/
+void benchSkewed(int n) {
+    const char *names[] = {"bst", "splay", "semi"};
+    BSTree *tree;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, j, tmp, mode, hits;
+    double start, elapsed;
+
+    keys = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        keys[i] = benchZipfKey(i);
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(benchRandom(&state) % (uint64_t)(i + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    probes = benchZipf(n, BENCH_LOOKUPS, &state);
+    for (mode = SPLAY_OFF; mode <= SPLAY_SEMI; mode++) {
+        tree = treeCreate();
+        tree->splay = mode;
+        for (i = 0; i < n; i++) {
+            treeAdd(tree, nodeAlloc(tree, keys[i]));
+        }
+        hits = 0;
+        start = benchNow();
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+            hits += treeFind(tree, probes[i]) != NULL;
+        }
+        elapsed = benchNow() - start;
+        printf("{\"bench\":\"skewed\",\"tree\":\"%s\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"height\":%d}\n",
+            names[mode], n, BENCH_LOOKUPS / elapsed, hits, treeHeight(tree->root));
+        treeDestroy(tree);
+    }
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Insert n ascending keys with insertSortedBatch and with n independent treeInserts, once into an empty tree, where the
+independent inserts build a chain, and once into a tree already holding n shuffled even keys, with the batch made of
+the odd keys in between. Then search every even key in ascending order with a finger and from the root*/
+void benchFinger(int n) {
+    const char *phases[] = {"ascending", "interleaved"};
+    BSTree *tree;
+    Finger finger;
+    uint64_t state = 88172645463325252ULL;
+    int *even, *batch;
+    int i, j, tmp, phase, fingered, hits;
+    double start, rate[2];
+
+    even = malloc(n * sizeof(int));
+    batch = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        even[i] = 2 * i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(benchRandom(&state) % (uint64_t)(i + 1));
+        tmp = even[i];
+        even[i] = even[j];
+        even[j] = tmp;
+    }
+    for (phase = 0; phase <= 1; phase++) {
+        for (i = 0; i < n; i++) {
+            batch[i] = phase ? 2 * i + 1 : i;
+        }
+        for (fingered = 0; fingered <= 1; fingered++) {
+            tree = treeCreate();
+            for (i = 0; phase && i < n; i++) {
+                treeInsert(&(tree->root), nodeAlloc(tree, even[i]));
+            }
+            start = benchNow();
+            if (fingered) {
+                insertSortedBatch(tree, batch, n);
+            } else {
+                for (i = 0; i < n; i++) {
+                    treeInsert(&(tree->root), nodeAlloc(tree, batch[i]));
+                }
+            }
+            rate[fingered] = n / (benchNow() - start);
+            treeDestroy(tree);
+        }
+        printf("{\"bench\":\"finger\",\"phase\":\"%s\",\"n\":%d,\"independent_per_sec\":%.0f,"
+            "\"batch_per_sec\":%.0f,\"speedup\":%.2f}\n", phases[phase], n, rate[0], rate[1], rate[1] / rate[0]);
+    }
+
+    tree = treeCreate();
+    for (i = 0; i < n; i++) {
+        treeInsert(&(tree->root), nodeAlloc(tree, even[i]));
+    }
+    for (fingered = 0; fingered <= 1; fingered++) {
+        fingerInit(tree, &finger);
+        hits = 0;
+        start = benchNow();
+        for (i = 0; i < n; i++) {
+            if (fingered) {
+                hits += fingerSearch(&finger, 2 * i) != NULL;
+            } else {
+                hits += iterativeTreeSearch(tree->root, 2 * i) != NULL;
+            }
+        }
+        rate[fingered] = n / (benchNow() - start);
+    }
+    printf("{\"bench\":\"finger\",\"phase\":\"search\",\"n\":%d,\"root_per_sec\":%.0f,\"finger_per_sec\":%.0f,"
+        "\"speedup\":%.2f,\"hits\":%d}\n", n, rate[0], rate[1], rate[1] / rate[0], hits);
+    treeDestroy(tree);
+    free(even);
+    free(batch);
+    return;
+}
@@ -6,8 +6,82 @@ Red-Black Trees are binary trees that satisfy the following red-black properties
 4. If a node is red, then both its children are black
 5. For each node, all simple paths from the node to descendant leaves contain the same number of black nodes */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE //For MAP_ANONYMOUS
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Order-statistic augmentation: every node records the size of its subtree, which makes rank and select O(log n).
+//Compile with -DRB_ORDER_STATISTICS=1 to add the field. It is off by default since every insert, delete and rotation
+//has to keep it up to date
+#ifndef RB_ORDER_STATISTICS
+#define RB_ORDER_STATISTICS 0
+#endif
+
+//Interval augmentation as in CLRS 14.3: every node holds the interval [item, high] and the largest high end in its
+//subtree, which makes overlap queries O(log n). Plain inserts hold the interval [item, item].
+//Compile with -DRB_INTERVALS=1 to add the fields along with rbIntervalInsert and the other interval functions. It is off
+//by default so that plain trees do not carry the fields or their upkeep
+#ifndef RB_INTERVALS
+#define RB_INTERVALS 0
+#endif
+
+//Hot-path instrumentation. Compile with -DRB_STATS=1 to count comparisons, rotations, fixup iterations, depths and slab
+//allocations in per-thread counters. By default every hook expands to nothing and the counters do not exist
+#ifndef RB_STATS
+#define RB_STATS 0
+#endif
+#define RB_STATS_DEPTHS 64 //Buckets of the depth histograms. Deeper paths are counted in the last one
+#define RB_STATS_FIXUPS 16 //Buckets of the fixup iteration histograms
+
+typedef struct _rbstats{
+uint64_t searches; //Calls of rbIterativeTreeSearch
+uint64_t searchComparisons; //Key comparisons made by those searches
+uint64_t searchDepth[RB_STATS_DEPTHS]; //Searches by number of nodes visited
+uint64_t inserts;
+uint64_t insertDepth[RB_STATS_DEPTHS]; //Inserts by depth of the new node, the root being at depth 0
+uint64_t insertFixups[RB_STATS_FIXUPS]; //Calls of rbInsertFixUp by iterations of its recoloring loop
+uint64_t deletes;
+uint64_t deleteFixups[RB_STATS_FIXUPS]; //Deletes by iterations of the loop in rbDeleteFixUp, 0 if it was not needed
+uint64_t leftRotations;
+uint64_t rightRotations;
+uint64_t slabAllocations; //Slabs malloc'd by the node pools
+double slabSeconds; //Time spent in those mallocs
+} RBStats;
+
+#if RB_STATS
+//The counters of one thread. Threads link their block into a global list the first time they count something
+typedef struct _rbstatsblock{
+struct _rbstats stats;
+struct _rbstatsblock *next;
+int registered;
+} RBStatsBlock;
+
+#define RB_STATS_SELF() (rbStatsLocal.registered ? &rbStatsLocal : rbStatsRegister())
+#define RB_STAT(field) (RB_STATS_SELF()->stats.field++)
+#define RB_STAT_ADD(field, n) (RB_STATS_SELF()->stats.field += (n))
+#define RB_STAT_BUCKET(field, i, buckets) (RB_STATS_SELF()->stats.field[(i) < (buckets) ? (i) : (buckets) - 1]++)
+#else
+#define RB_STAT(field) ((void)0)
+#define RB_STAT_ADD(field, n) ((void)0)
+#define RB_STAT_BUCKET(field, i, buckets) ((void)0)
+#endif
 
 typedef struct _rbtnode{
 int item;
@@ -15,44 +89,992 @@ int color; //0 == BLACK, 1 == RED
 struct _rbtnode *left;
 struct _rbtnode *right;
 struct _rbtnode *parent;
+#if RB_ORDER_STATISTICS
+int size; //Number of items in the subtree rooted here, copies included, 0 for the sentinel
+#endif
+int count; //Copies of item held by the node. Always 1 unless the tree is a multiset
+#if RB_INTERVALS
+int high; //High end of the interval whose low end is item
+int max; //Largest high in the subtree rooted here, INT_MIN for the sentinel
+#endif
 } RBTNode;
 
+#if RB_ORDER_STATISTICS
+#define RB_UPDATE_SIZE(node) ((node)->size = (node)->left->size + (node)->right->size + (node)->count)
+#else
+#define RB_UPDATE_SIZE(node) ((void)0)
+#endif
+
+#if RB_INTERVALS
+#define RB_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define RB_UPDATE_MAX(node) ((node)->max = RB_MAX((node)->high, RB_MAX((node)->left->max, (node)->right->max)))
+#else
+#define RB_UPDATE_MAX(node) ((void)0)
+#endif
+
+//Nodes are carved out of contiguous slabs instead of being malloc'd one at a time
+typedef struct _rbtnodeslab{
+struct _rbtnodeslab *next;
+int capacity;
+RBTNode nodes[];
+} RBTNodeSlab;
+
+typedef struct _rbtnodepool{
+struct _rbtnodeslab *slabs; //Most recently allocated slab first
+struct _rbtnode *freeList; //Recycled nodes, chained through their right pointer
+int used; //Number of nodes handed out from the head slab
+int refs; //Number of trees drawing nodes from the pool. They also share its sentinel
+} RBTNodePool;
+
+#define RB_CACHE_WAYS 2
+#define RB_CACHE_LINE 64
+#define RB_CACHE_SETS 4096 //Sets of the cache enabled by "batch -k"
+#define RB_CACHE_SET(cache, key) (((uint32_t)(key) * 2654435761u) >> (cache)->shift)
+
+//One set of the hot-key cache. It is padded to 32 bytes so that two sets share a cache line and a probe touches one
+typedef struct _rbcacheset{
+int keys[RB_CACHE_WAYS];
+int recent; //Way that was hit or filled last. A miss replaces the other one
+int pad;
+struct _rbtnode *nodes[RB_CACHE_WAYS]; //NULL for an empty way
+} RBCacheSet;
+
+//Two-way set associative cache from keys to the nodes holding them, sitting in front of rbCachedSearch. Only keys that
+//are present are cached, so inserts never make an entry stale and only removing a node has to invalidate one
+typedef struct _rbcache{
+struct _rbcacheset *sets; //Aligned to RB_CACHE_LINE
+int size; //Number of sets, a power of two
+int shift; //The top 32 - shift bits of the hashed key select the set
+uint64_t hits;
+uint64_t misses;
+uint64_t invalidations; //Entries dropped because their node left the tree
+} RBCache;
+
 typedef struct _rbtree{
     struct _rbtnode *nil;
     struct _rbtnode *root;
+    struct _rbtnodepool *pool;
+    int multiset; //Nonzero if repeated keys share one node and its count. rbTreeCreate starts with 0
+    struct _rbcache *cache; //Hot-key cache of rbCachedSearch, NULL unless enabled with rbCacheEnable
 } RBTree;
 
+//In-order cursor built on the parent pointers and rbTreeSuccessor, so a walk takes O(1) extra space
+typedef struct _rbiterator{
+struct _rbtree *tree;
+struct _rbtnode *node; //Node returned by the next call to rbIteratorNext, nil once the walk is over
+} RBIterator;
+
+//Cursor for finger searches and inserts, which start from the node touched last instead of the root. It only stays
+//valid while the tree is changed through it alone, and has to be initialized again after any other insert or delete
+typedef struct _rbfinger{
+struct _rbtree *tree;
+struct _rbtnode *node; //Node touched last, nil if the tree was empty
+struct _rbtnode *next; //In-order successor of node, nil if node holds the largest item, NULL if not known yet
+} RBFinger;
+
+#define RB_BUFFER_REBUILD 16 //A merge rebuilds the tree when the buffer holds at least 1/RB_BUFFER_REBUILD of its size
+
+//Operation held in the write buffer of an RBBufferedTree
+typedef struct _rbwriteop{
+int key;
+int insert; //1 to insert key, 0 for a tombstone that deletes it
+} RBWriteOp;
+
+//Ingestion front end of a red-black tree holding a set of keys. Inserts and deletes are appended to a buffer of
+//capacity operations, and only reach the tree once the buffer is full, sorted and merged in one pass. A hash index
+//from each buffered key to its latest operation lets lookups check the buffer in O(1) before they search the tree
+typedef struct _rbbufferedtree{
+struct _rbtree *tree;
+struct _rbwriteop *ops; //In arrival order. A key appended again supersedes its earlier operations
+int *index; //Open addressing table of positions in ops, -1 for an empty slot
+int count; //Number of operations in ops
+int capacity; //Merge threshold, set by rbBufferedCreate
+int mask; //Slots in index minus one
+int size; //Number of keys in the tree
+uint64_t merges;
+uint64_t lookups;
+uint64_t probes; //Index slots examined by lookups
+uint64_t treeSearches; //Lookups the buffer could not answer
+} RBBufferedTree;
+
+#define RB_SLAB_MIN 64
+#define RB_SLAB_MAX 65536
+
+//One step of a parallel set operation: combine the detached subtrees a and b into result. Tasks are forked onto the
+//deque of the worker that created them, from where idle workers can steal them
+typedef struct _rbsettask{
+struct _rbtree *tree;
+char op; //'u' for union, 'i' for intersection, 'd' for difference
+struct _rbtnode *a;
+struct _rbtnode *b;
+struct _rbtnode *result;
+int aHeight; //Black-heights of a, b and result
+int bHeight;
+int resultHeight;
+atomic_int done; //Set once result is ready
+} RBSetTask;
+
+//Deque slots per worker. Forks nest no deeper than the height of the smaller tree, so this is never reached in practice;
+//a fork that does not fit simply runs inline
+#define RB_DEQUE_SIZE 128
+//Subtrees whose black-heights add up to less than this are combined sequentially, without forking
+#ifndef RB_SET_GRAIN
+#define RB_SET_GRAIN 16
+#endif
+
+typedef struct _rbworker{
+struct _rbthreadpool *threads; //NULL when the operation runs on the calling thread alone
+pthread_mutex_t lock;
+struct _rbsettask *deque[RB_DEQUE_SIZE];
+int head; //Thieves take the oldest, largest task from the head
+int tail; //The owner pushes and pops at the tail
+struct _rbtnode *garbage; //Subtrees dropped by the operation, chained through their parent pointers
+uint64_t seed; //Picks the victims to steal from
+} RBWorker;
+
+//Work-stealing pool for the set operations. The calling thread acts as worker 0, so a pool of one thread starts none
+typedef struct _rbthreadpool{
+int count;
+struct _rbworker *workers;
+pthread_t *ids;
+pthread_mutex_t lock;
+pthread_cond_t wake;
+atomic_int active; //Nonzero while an operation runs. Idle workers only look for tasks then
+atomic_int stop;
+} RBThreadPool;
+
+//Node of the path-copying trees, the concurrent tree and the persistent versions. Shared nodes are never modified: an
+//update copies every node it would change, so older roots stay valid and readers can walk them without locks. There
+//is no parent pointer, because a copied node would have to update its children, and the fixups climb a stack of the
+//copied path instead
+typedef struct _rbpnode{
+int item;
+int color;
+int refs; //Number of parents and versions sharing the node. Only kept by reference counted stores
+struct _rbpnode *left; //NULL takes the place of the sentinel
+struct _rbpnode *right;
+} RBPNode;
+
+#define RBP_IS_RED(node) ((node) != NULL && (node)->color == 1)
+//Longest root-to-leaf path the fixup stacks hold. A red-black tree of up to 2^31 items is at most 62 nodes deep
+#define RB_PATH_MAX 128
+#define RB_RCU_READERS 64
+
+//Supplies the nodes of path-copying updates and disposes of the nodes they replace. A reference counted store frees a
+//node once nothing shares it. Otherwise replaced nodes are collected in retiring for the owner to reclaim
+typedef struct _rbpstore{
+int counted;
+struct _rbpnode *freeList; //Reclaimed nodes, chained through their left pointer
+long live; //Nodes handed out and not yet reclaimed
+struct _rbpnode *retiring[3 * RB_PATH_MAX]; //Nodes replaced by the update in progress
+int retiringCount;
+} RBPStore;
+
+//Handle on one immutable version of a persistent tree. Versions created from one another share all but O(log n) nodes
+typedef struct _rbversion{
+struct _rbpstore *store;
+struct _rbpnode *root;
+int count; //Number of items
+int refs; //Number of holders of the handle
+} RBVersion;
+
+//A registered reader. Its epoch is the tree's epoch when it entered its current read, or 0 between reads. Each reader
+//has its own cache line so that readers do not slow each other down
+typedef struct _rbrcureader{
+struct _rbrcutree *tree;
+atomic_ullong epoch;
+atomic_int used;
+char pad[64 - sizeof(struct _rbrcutree *) - sizeof(atomic_ullong) - sizeof(atomic_int)];
+} RBRcuReader;
+
+//Nodes replaced by one update, freed once no reader that might still see them is left
+typedef struct _rbrcuretired{
+struct _rbrcuretired *next;
+unsigned long long epoch; //Tree epoch in which the update was published
+int count;
+struct _rbpnode *nodes[];
+} RBRcuRetired;
+
+//Red-black tree for many concurrent readers and one writer at a time. The writer builds each new version by path
+//copying and publishes it with an atomic store of the root. Replaced nodes are reclaimed by epochs
+typedef struct _rbrcutree{
+_Atomic(struct _rbpnode *) root;
+atomic_ullong epoch; //Advanced after every published update, starts at 1
+struct _rbrcureader readers[RB_RCU_READERS];
+pthread_mutex_t writer; //Serializes updates
+struct _rbrcuretired *limbo; //Oldest first
+struct _rbrcuretired *limboTail;
+struct _rbpstore store; //Not reference counted. Only the writer touches it
+} RBRcuTree;
+
+//Node of RBTDTree, the top-down red-black tree. Insert and delete rebalance in a single pass on their way down, so
+//nothing ever climbs back up and the node needs no parent pointer. 24 bytes against the 48 of RBTNode
+typedef struct _rbtdnode{
+int item;
+unsigned char color; //0 == BLACK, 1 == RED
+atomic_flag lock; //Only taken in concurrent trees
+struct _rbtdnode *link[2]; //Left and right child, NULL for a leaf
+} RBTDNode;
+
+#define RBTD_RED(node) ((node) != NULL && (node)->color == 1)
+#define RBTD_HELD 16 //Most locks one operation holds at once
+
+//Set of keys kept in a top-down red-black tree. In a concurrent tree every operation lock-couples down from the false
+//root: it locks a child before it lets go of the nodes above, and only keeps the few levels its rebalancing can touch.
+//Writers then only wait for each other near the top, and run in parallel once their paths split
+typedef struct _rbtdtree{
+struct _rbtdnode head; //False root whose right child is the root. Rotations at the root change its link like any other
+int concurrent; //Nonzero if operations lock the nodes they touch, so that they can run from several threads at once
+} RBTDTree;
+
+//Locks held by one operation on an RBTDTree
+typedef struct _rbtdlocks{
+struct _rbtdnode *nodes[RBTD_HELD];
+int count;
+int active; //Copy of the tree's concurrent flag. Nothing is locked when it is 0
+} RBTDLocks;
+
+//Number of searches rbTreeSearchBatch advances in lock-step. Large enough to keep several cache misses in flight.
+#define RB_BATCH_GROUP 16
+
+//Compact alternative to RBTNode, stored in one contiguous array. The links are 32-bit indices into that array with
+//index 0 acting as the sentinel, and the color is packed into the top bit of the parent index (set == RED)
+typedef struct _rbcnode{
+int item;
+uint32_t left;
+uint32_t right;
+uint32_t parentColor;
+} RBCNode;
+
+typedef struct _rbctree{
+struct _rbcnode *nodes;
+uint32_t root;
+uint32_t count; //Number of array slots in use, including the sentinel
+uint32_t capacity;
+void *mapping; //Set while the nodes live in a private mapping of a tree image rather than on the heap
+size_t mappingLength;
+} RBCTree;
+
+//A tree image is this header followed directly by the node array of an RBCTree, sentinel included, so a mapped image
+//can be searched in place. Nodes are stored in breadth-first order and all fields are in native byte order
+#define RB_IMAGE_MAGIC "RBTIMAGE"
+#define RB_IMAGE_VERSION 1
+
+typedef struct _rbimageheader{
+char magic[8];
+uint32_t version;
+uint32_t nodeSize; //sizeof(RBCNode) of the writer, checked by the loader
+uint32_t count; //Number of items
+uint32_t height; //Number of nodes on the longest root-to-leaf path
+uint32_t root; //Index of the root, RBC_NIL for an empty tree
+uint32_t reserved;
+uint64_t checksum; //FNV-1a over the node array
+} RBImageHeader;
+
+//A tree image mapped read-only. view is an RBCTree over the mapped nodes that the rbc search functions accept as is
+typedef struct _rbimage{
+int fd; //Kept open for rbImageThaw
+void *mapping;
+size_t length;
+const struct _rbimageheader *header;
+struct _rbctree view;
+} RBImage;
+
+#define RBC_NIL 0
+#define RBC_RED 0x80000000u
+#define RBC_PARENT(tree, i) ((tree)->nodes[i].parentColor & ~RBC_RED)
+#define RBC_IS_RED(tree, i) (((tree)->nodes[i].parentColor & RBC_RED) != 0)
+#define RBC_SET_PARENT(tree, i, p) ((tree)->nodes[i].parentColor = ((tree)->nodes[i].parentColor & RBC_RED) | (p))
+#define RBC_SET_RED(tree, i) ((tree)->nodes[i].parentColor |= RBC_RED)
+#define RBC_SET_BLACK(tree, i) ((tree)->nodes[i].parentColor &= ~RBC_RED)
+
+//Immutable read-only copy of a tree. The sorted keys form level 0, and every level above holds the largest key of each
+//block of RB_SNAPSHOT_B keys below it, so a lookup descends one block per level. A block is one 64-byte cache line,
+//which is compared against the search key in a single step with SIMD instructions when they are available
+#define RB_SNAPSHOT_B 16
+#define RB_SNAPSHOT_MAX_LEVELS 9
+
+typedef struct _rbsnapshot{
+int n;
+int levels;
+int blocks[RB_SNAPSHOT_MAX_LEVELS]; //Number of blocks in each level
+int *level[RB_SNAPSHOT_MAX_LEVELS]; //level[0] is the sorted keys padded with INT_MAX to whole blocks
+} RBSnapshot;
+
+//Operations understood by the batch engine. In the text format an operation is the opcode letter followed by its
+//integer arguments, e.g. "i 5" or "r 10 20". In the binary format it is the opcode byte followed by its arguments as
+//4-byte little-endian integers. 'i' inserts, 'd' deletes, 's' searches, 'r' lists the keys in [a, b], 'p' lists all
+typedef struct _rbcommand{
+char op;
+int a;
+int b;
+} RBCommand;
+
+#define RB_IO_BUFFER 65536
+
+typedef struct _rbreader{
+FILE *in;
+size_t pos;
+size_t len;
+unsigned char buf[RB_IO_BUFFER];
+} RBReader;
+
+typedef struct _rbwriter{
+FILE *out;
+size_t len;
+char buf[RB_IO_BUFFER];
+} RBWriter;
+
+//Generator of red-black trees specialized to one key type, value type and ordering. less(a, b) and equal(a, b) are
+//expanded in place, so every comparison is inlined and keys and values are stored by value instead of through void
+//pointers. Two predicates rather than one three-way comparison keep the search loop as short as the one of
+//rbIterativeTreeSearch, since the compiler does not fold a three-way result back into a single compare.
+//RB_DEFINE_TREE(Type, prefix, ...) defines the types Type and TypeNode and the functions prefixCreate, prefixDestroy,
+//prefixSearch, prefixGet, prefixPut, prefixDelete, prefixMin and prefixNext. The algorithms are the ones of RBTree,
+//with the sentinel held in the handle
+#define RB_DEFINE_TREE(Type, prefix, Key, Value, less, equal) \
+typedef struct _##Type##Node{                                                                                         \
+Key key;                                                                                                              \
+Value value;                                                                                                          \
+int color; /*0 == BLACK, 1 == RED*/                                                                                   \
+struct _##Type##Node *parent;                                                                                         \
+struct _##Type##Node *left;                                                                                           \
+struct _##Type##Node *right;                                                                                          \
+} Type##Node;                                                                                                         \
+                                                                                                                      \
+typedef struct _##Type##Slab{                                                                                         \
+struct _##Type##Slab *next;                                                                                           \
+int capacity;                                                                                                         \
+Type##Node nodes[];                                                                                                   \
+} Type##Slab;                                                                                                         \
+                                                                                                                      \
+typedef struct _##Type{                                                                                               \
+Type##Node *root;                                                                                                     \
+Type##Node nil; /*Sentinel, black. Lives in the handle so the tree needs no allocation beyond its slabs*/             \
+Type##Slab *slabs; /*Most recently allocated slab first*/                                                             \
+Type##Node *freeList; /*Recycled nodes, chained through their right pointer*/                                         \
+int used; /*Number of nodes handed out from the head slab*/                                                           \
+int count;                                                                                                            \
+} Type;                                                                                                               \
+                                                                                                                      \
+static inline Type *prefix##Create(void) {                                                                            \
+    Type *tree = malloc(sizeof(Type));                                                                                \
+    tree->nil.color = 0;                                                                                              \
+    tree->nil.parent = &(tree->nil);                                                                                  \
+    tree->nil.left = &(tree->nil);                                                                                    \
+    tree->nil.right = &(tree->nil);                                                                                   \
+    tree->root = &(tree->nil);                                                                                        \
+    tree->slabs = NULL;                                                                                               \
+    tree->freeList = NULL;                                                                                            \
+    tree->used = 0;                                                                                                   \
+    tree->count = 0;                                                                                                  \
+    return tree;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##Destroy(Type *tree) {                                                                      \
+    Type##Slab *slab, *next;                                                                                          \
+    for (slab = tree->slabs; slab != NULL; slab = next) {                                                             \
+        next = slab->next;                                                                                            \
+        free(slab);                                                                                                   \
+    }                                                                                                                 \
+    free(tree);                                                                                                       \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/*Return the node holding key, or NULL if there is none. Its value can be read and written in place*/                 \
+static inline Type##Node *prefix##Search(Type *tree, Key key) {                                                       \
+    Type##Node *node = tree->root;                                                                                    \
+    while (node != &(tree->nil) && !equal(key, node->key)) {                                                          \
+        node = less(key, node->key) ? node->left : node->right;                                                       \
+    }                                                                                                                 \
+    return node == &(tree->nil) ? NULL : node;                                                                        \
+}                                                                                                                     \
+                                                                                                                      \
+/*Store the value mapped to key in *value and return 1, or return 0 if key is absent*/                                \
+static inline int prefix##Get(Type *tree, Key key, Value *value) {                                                    \
+    Type##Node *node = prefix##Search(tree, key);                                                                     \
+    if (node == NULL) {                                                                                               \
+        return 0;                                                                                                     \
+    }                                                                                                                 \
+    *value = node->value;                                                                                             \
+    return 1;                                                                                                         \
+}                                                                                                                     \
+                                                                                                                      \
+static inline Type##Node *prefix##Min(Type *tree) {                                                                   \
+    Type##Node *node = tree->root;                                                                                    \
+    if (node == &(tree->nil)) {                                                                                       \
+        return NULL;                                                                                                  \
+    }                                                                                                                 \
+    while (node->left != &(tree->nil)) {                                                                              \
+        node = node->left;                                                                                            \
+    }                                                                                                                 \
+    return node;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/*In-order successor of node, or NULL after the last one*/                                                            \
+static inline Type##Node *prefix##Next(Type *tree, Type##Node *node) {                                                \
+    Type##Node *parent;                                                                                               \
+    if (node->right != &(tree->nil)) {                                                                                \
+        for (node = node->right; node->left != &(tree->nil); node = node->left)                                       \
+            ;                                                                                                         \
+        return node;                                                                                                  \
+    }                                                                                                                 \
+    for (parent = node->parent; parent != &(tree->nil) && node == parent->right; parent = parent->parent) {           \
+        node = parent;                                                                                                \
+    }                                                                                                                 \
+    return parent == &(tree->nil) ? NULL : parent;                                                                    \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##LeftRotate(Type *tree, Type##Node *node) {                                                 \
+    Type##Node *rNode = node->right;                                                                                  \
+    node->right = rNode->left;                                                                                        \
+    if (rNode->left != &(tree->nil)) {                                                                                \
+        rNode->left->parent = node;                                                                                   \
+    }                                                                                                                 \
+    rNode->parent = node->parent;                                                                                     \
+    if (node->parent == &(tree->nil)) {                                                                               \
+        tree->root = rNode;                                                                                           \
+    } else if (node == node->parent->left) {                                                                          \
+        node->parent->left = rNode;                                                                                   \
+    } else {                                                                                                          \
+        node->parent->right = rNode;                                                                                  \
+    }                                                                                                                 \
+    rNode->left = node;                                                                                               \
+    node->parent = rNode;                                                                                             \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##RightRotate(Type *tree, Type##Node *node) {                                                \
+    Type##Node *lNode = node->left;                                                                                   \
+    node->left = lNode->right;                                                                                        \
+    if (lNode->right != &(tree->nil)) {                                                                               \
+        lNode->right->parent = node;                                                                                  \
+    }                                                                                                                 \
+    lNode->parent = node->parent;                                                                                     \
+    if (node->parent == &(tree->nil)) {                                                                               \
+        tree->root = lNode;                                                                                           \
+    } else if (node == node->parent->right) {                                                                         \
+        node->parent->right = lNode;                                                                                  \
+    } else {                                                                                                          \
+        node->parent->left = lNode;                                                                                   \
+    }                                                                                                                 \
+    lNode->right = node;                                                                                              \
+    node->parent = lNode;                                                                                             \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+static inline Type##Node *prefix##NodeAlloc(Type *tree) {                                                             \
+    Type##Slab *slab;                                                                                                 \
+    Type##Node *node;                                                                                                 \
+    int capacity;                                                                                                     \
+    if (tree->freeList != NULL) {                                                                                     \
+        node = tree->freeList;                                                                                        \
+        tree->freeList = node->right;                                                                                 \
+        return node;                                                                                                  \
+    }                                                                                                                 \
+    if (tree->slabs == NULL || tree->used == tree->slabs->capacity) {                                                 \
+        capacity = tree->slabs == NULL ? RB_SLAB_MIN : tree->slabs->capacity * 2;                                     \
+        if (capacity > RB_SLAB_MAX) {                                                                                 \
+            capacity = RB_SLAB_MAX;                                                                                   \
+        }                                                                                                             \
+        slab = malloc(sizeof(Type##Slab) + capacity * sizeof(Type##Node));                                            \
+        slab->next = tree->slabs;                                                                                     \
+        slab->capacity = capacity;                                                                                    \
+        tree->slabs = slab;                                                                                           \
+        tree->used = 0;                                                                                               \
+    }                                                                                                                 \
+    return &(tree->slabs->nodes[tree->used++]);                                                                       \
+}                                                                                                                     \
+                                                                                                                      \
+/*Map key to value. Returns 1 if key was added and 0 if it was already present, in which case its value is replaced*/ \
+static inline int prefix##Put(Type *tree, Key key, Value value) {                                                     \
+    Type##Node *parent = &(tree->nil), *cur = tree->root, *node, *uncle;                                              \
+    int goLeft = 0;                                                                                                   \
+    while (cur != &(tree->nil)) {                                                                                     \
+        if (equal(key, cur->key)) {                                                                                   \
+            cur->value = value;                                                                                       \
+            return 0;                                                                                                 \
+        }                                                                                                             \
+        parent = cur;                                                                                                 \
+        goLeft = less(key, cur->key);                                                                                 \
+        cur = goLeft ? cur->left : cur->right;                                                                        \
+    }                                                                                                                 \
+    node = prefix##NodeAlloc(tree);                                                                                   \
+    node->key = key;                                                                                                  \
+    node->value = value;                                                                                              \
+    node->color = 1;                                                                                                  \
+    node->left = &(tree->nil);                                                                                        \
+    node->right = &(tree->nil);                                                                                       \
+    node->parent = parent;                                                                                            \
+    if (parent == &(tree->nil)) {                                                                                     \
+        tree->root = node;                                                                                            \
+    } else if (goLeft) {                                                                                              \
+        parent->left = node;                                                                                          \
+    } else {                                                                                                          \
+        parent->right = node;                                                                                         \
+    }                                                                                                                 \
+    tree->count++;                                                                                                    \
+    /*Same fixup as rbInsertFixUp*/                                                                                   \
+    while (node->parent->color == 1) {                                                                                \
+        if (node->parent == node->parent->parent->left) {                                                             \
+            uncle = node->parent->parent->right;                                                                      \
+            if (uncle->color == 1) {                                                                                  \
+                node->parent->color = 0;                                                                              \
+                uncle->color = 0;                                                                                     \
+                node->parent->parent->color = 1;                                                                      \
+                node = node->parent->parent;                                                                          \
+            } else {                                                                                                  \
+                if (node == node->parent->right) {                                                                    \
+                    node = node->parent;                                                                              \
+                    prefix##LeftRotate(tree, node);                                                                   \
+                }                                                                                                     \
+                node->parent->color = 0;                                                                              \
+                node->parent->parent->color = 1;                                                                      \
+                prefix##RightRotate(tree, node->parent->parent);                                                      \
+            }                                                                                                         \
+        } else {                                                                                                      \
+            uncle = node->parent->parent->left;                                                                       \
+            if (uncle->color == 1) {                                                                                  \
+                node->parent->color = 0;                                                                              \
+                uncle->color = 0;                                                                                     \
+                node->parent->parent->color = 1;                                                                      \
+                node = node->parent->parent;                                                                          \
+            } else {                                                                                                  \
+                if (node == node->parent->left) {                                                                     \
+                    node = node->parent;                                                                              \
+                    prefix##RightRotate(tree, node);                                                                  \
+                }                                                                                                     \
+                node->parent->color = 0;                                                                              \
+                node->parent->parent->color = 1;                                                                      \
+                prefix##LeftRotate(tree, node->parent->parent);                                                       \
+            }                                                                                                         \
+        }                                                                                                             \
+    }                                                                                                                 \
+    tree->root->color = 0;                                                                                            \
+    return 1;                                                                                                         \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void prefix##Transplant(Type *tree, Type##Node *old, Type##Node *node) {                                \
+    if (old->parent == &(tree->nil)) {                                                                                \
+        tree->root = node;                                                                                            \
+    } else if (old == old->parent->left) {                                                                            \
+        old->parent->left = node;                                                                                     \
+    } else {                                                                                                          \
+        old->parent->right = node;                                                                                    \
+    }                                                                                                                 \
+    node->parent = old->parent;                                                                                       \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/*Same fixup as rbDeleteFixUp*/                                                                                       \
+static inline void prefix##DeleteFixUp(Type *tree, Type##Node *node) {                                                \
+    Type##Node *sibling;                                                                                              \
+    while (node != tree->root && node->color == 0) {                                                                  \
+        if (node == node->parent->left) {                                                                             \
+            sibling = node->parent->right;                                                                            \
+            if (sibling->color == 1) {                                                                                \
+                sibling->color = 0;                                                                                   \
+                node->parent->color = 1;                                                                              \
+                prefix##LeftRotate(tree, node->parent);                                                               \
+                sibling = node->parent->right;                                                                        \
+            }                                                                                                         \
+            if (sibling->left->color == 0 && sibling->right->color == 0) {                                            \
+                sibling->color = 1;                                                                                   \
+                node = node->parent;                                                                                  \
+            } else {                                                                                                  \
+                if (sibling->right->color == 0) {                                                                     \
+                    sibling->left->color = 0;                                                                         \
+                    sibling->color = 1;                                                                               \
+                    prefix##RightRotate(tree, sibling);                                                               \
+                    sibling = node->parent->right;                                                                    \
+                }                                                                                                     \
+                sibling->color = node->parent->color;                                                                 \
+                node->parent->color = 0;                                                                              \
+                sibling->right->color = 0;                                                                            \
+                prefix##LeftRotate(tree, node->parent);                                                               \
+                node = tree->root;                                                                                    \
+            }                                                                                                         \
+        } else {                                                                                                      \
+            sibling = node->parent->left;                                                                             \
+            if (sibling->color == 1) {                                                                                \
+                sibling->color = 0;                                                                                   \
+                node->parent->color = 1;                                                                              \
+                prefix##RightRotate(tree, node->parent);                                                              \
+                sibling = node->parent->left;                                                                         \
+            }                                                                                                         \
+            if (sibling->right->color == 0 && sibling->left->color == 0) {                                            \
+                sibling->color = 1;                                                                                   \
+                node = node->parent;                                                                                  \
+            } else {                                                                                                  \
+                if (sibling->left->color == 0) {                                                                      \
+                    sibling->right->color = 0;                                                                        \
+                    sibling->color = 1;                                                                               \
+                    prefix##LeftRotate(tree, sibling);                                                                \
+                    sibling = node->parent->left;                                                                     \
+                }                                                                                                     \
+                sibling->color = node->parent->color;                                                                 \
+                node->parent->color = 0;                                                                              \
+                sibling->left->color = 0;                                                                             \
+                prefix##RightRotate(tree, node->parent);                                                              \
+                node = tree->root;                                                                                    \
+            }                                                                                                         \
+        }                                                                                                             \
+    }                                                                                                                 \
+    node->color = 0;                                                                                                  \
+    return;                                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/*Remove key and its value. Returns 1 if key was present*/                                                            \
+static inline int prefix##Delete(Type *tree, Key key) {                                                               \
+    Type##Node *node = prefix##Search(tree, key), *successor, *replacement;                                           \
+    int removedColor;                                                                                                 \
+    if (node == NULL) {                                                                                               \
+        return 0;                                                                                                     \
+    }                                                                                                                 \
+    removedColor = node->color;                                                                                       \
+    if (node->left == &(tree->nil)) {                                                                                 \
+        replacement = node->right;                                                                                    \
+        prefix##Transplant(tree, node, node->right);                                                                  \
+    } else if (node->right == &(tree->nil)) {                                                                         \
+        replacement = node->left;                                                                                     \
+        prefix##Transplant(tree, node, node->left);                                                                   \
+    } else {                                                                                                          \
+        for (successor = node->right; successor->left != &(tree->nil); successor = successor->left)                   \
+            ;                                                                                                         \
+        removedColor = successor->color;                                                                              \
+        replacement = successor->right;                                                                               \
+        if (successor->parent == node) {                                                                              \
+            replacement->parent = successor; /*Needed when replacement is the sentinel*/                              \
+        } else {                                                                                                      \
+            prefix##Transplant(tree, successor, successor->right);                                                    \
+            successor->right = node->right;                                                                           \
+            successor->right->parent = successor;                                                                     \
+        }                                                                                                             \
+        prefix##Transplant(tree, node, successor);                                                                    \
+        successor->left = node->left;                                                                                 \
+        successor->left->parent = successor;                                                                          \
+        successor->color = node->color;                                                                               \
+    }                                                                                                                 \
+    if (removedColor == 0) {                                                                                          \
+        prefix##DeleteFixUp(tree, replacement);                                                                       \
+    }                                                                                                                 \
+    node->right = tree->freeList;                                                                                     \
+    tree->freeList = node;                                                                                            \
+    tree->count--;                                                                                                    \
+    return 1;                                                                                                         \
+}                                                                                                                     \
+
+#define RB_LESS_NUMBER(a, b) ((a) < (b))
+#define RB_EQUAL_NUMBER(a, b) ((a) == (b))
+#define RB_BYTES_KEY_LENGTH 16
+#define RB_LESS_BYTES(a, b) rbBytesKeyLess(&(a), &(b))
+#define RB_EQUAL_BYTES(a, b) (memcmp((a).bytes, (b).bytes, RB_BYTES_KEY_LENGTH) == 0)
+
+//Fixed-length byte string key, ordered like memcmp. Shorter strings are padded with zeros
+typedef struct _rbbyteskey{
+unsigned char bytes[RB_BYTES_KEY_LENGTH];
+} RBBytesKey;
+
+/*memcmp order on two keys, computed 8 bytes at a time. A call to memcmp per node would cost more than the rest of the
+search step, while the equality test compiles to plain loads with the length known*/
+static inline int rbBytesKeyLess(const RBBytesKey *a, const RBBytesKey *b) {
+    uint64_t x, y;
+    int i;
+    for (i = 0; i < RB_BYTES_KEY_LENGTH; i += 8) {
+        memcpy(&x, a->bytes + i, 8);
+        memcpy(&y, b->bytes + i, 8);
+        if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            x = __builtin_bswap64(x);
+            y = __builtin_bswap64(y);
+#endif
+            return x < y;
+        }
+    }
+    return 0;
+}
+
+RB_DEFINE_TREE(RBInt32Map, rbInt32Map, int32_t, int32_t, RB_LESS_NUMBER, RB_EQUAL_NUMBER)
+RB_DEFINE_TREE(RBInt64Map, rbInt64Map, int64_t, int64_t, RB_LESS_NUMBER, RB_EQUAL_NUMBER)
+RB_DEFINE_TREE(RBUInt64Map, rbUInt64Map, uint64_t, uint64_t, RB_LESS_NUMBER, RB_EQUAL_NUMBER)
+RB_DEFINE_TREE(RBBytesMap, rbBytesMap, RBBytesKey, uint64_t, RB_LESS_BYTES, RB_EQUAL_BYTES)
+
+//Benchmarks are selected by name from the command line: ./RedBlackTrees bench <name> [n ...]
+typedef struct _rbbench{
+const char *name;
+void (*run)(int n);
+int sizes[4]; //Default problem sizes, terminated by 0 when fewer than four are used
+} RBBench;
+
+//State of one thread of a multi-threaded benchmark. rcu or a concurrent topDown selects a concurrent tree, otherwise
+//topDown or rbTree is used under lock
+typedef struct _rbbenchthread{
+struct _rbrcutree *rcu;
+struct _rbtdtree *topDown;
+struct _rbtree *rbTree;
+pthread_mutex_t *lock;
+atomic_int *stop;
+uint64_t seed;
+int n;
+long ops; //Operations completed before stop was set
+long hits;
+} RBBenchThread;
+
+#define RB_BENCH_LOOKUPS 1000000
+#define RB_BENCH_SECONDS 0.5 //Run time of every configuration of the multi-threaded benchmarks
+#define RB_BENCH_IMAGE "rbtree-bench.img" //Scratch file of the image benchmark, created in the working directory
+#define RB_BENCH_SAMPLE_EVERY 8
+#define RB_BENCH_CHURN_EVERY 16 //Lookups per delete and reinsert in the churn phase of the hot-key cache benchmark
+#define RB_BENCH_DELETE_EVERY 10 //Inserts per delete in the ingestion benchmark
+
+#if defined(__GNUC__)
+#define RB_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define RB_PREFETCH(address) ((void)(address))
+#endif
+
 void inOrderTreeWalk(RBTree *rbTree, RBTNode *node);
-RBTNode *rbTreeSearch(RBTNode *node, int key);
-RBTNode *rbIterativeTreeSearch(RBTNode *node, int key);
-RBTNode *rbTreeMin(RBTNode *node);
-RBTNode *rbTreeMax(RBTNode *node);
-RBTNode *rbTreeSuccessor(RBTNode *node);
-RBTNode *rbTreePredecessor(RBTNode *node);
+#if RB_STATS
+RBStatsBlock *rbStatsRegister(void);
+void rbStatsThreadExit(void *block);
+void rbStatsCreateKey(void);
+#endif
+void rbStatsCollect(RBStats *stats);
+void rbStatsReset(void);
+void rbStatsAdd(RBStats *total, const RBStats *stats);
+void rbStatsPrint(const RBStats *stats, FILE *out, int json);
+RBTNode *rbTreeSearch(RBTree *rbTree, RBTNode *node, int key);
+RBTNode *rbIterativeTreeSearch(RBTree *rbTree, RBTNode *node, int key);
+void rbTreeSearchBatch(RBTree *rbTree, const int *keys, int n, RBTNode **results);
+void rbCacheEnable(RBTree *rbTree, int sets);
+void rbCacheClear(RBTree *rbTree);
+RBTNode *rbCachedSearch(RBTree *rbTree, int key);
+void rbCacheInvalidate(RBTree *rbTree, RBTNode *node);
+RBTNode *rbTreeMin(RBTree *rbTree, RBTNode *node);
+RBTNode *rbTreeMax(RBTree *rbTree, RBTNode *node);
+RBTNode *rbTreeSuccessor(RBTree *rbTree, RBTNode *node);
+RBTNode *rbTreePredecessor(RBTree *rbTree, RBTNode *node);
+RBTNode *rbTreeLowerBound(RBTree *rbTree, int key);
+RBTNode *rbTreeUpperBound(RBTree *rbTree, int key);
+RBTNode *rbTreeFloor(RBTree *rbTree, int key);
+RBTNode *rbTreeCeiling(RBTree *rbTree, int key);
+int rbTreeRangeScan(RBTree *rbTree, int lo, int hi, int (*visit)(int key, void *context), void *context);
+int rbTreeRangeCopy(RBTree *rbTree, int lo, int hi, int *buffer, int capacity);
+int rbMultisetAdd(RBTree *rbTree, int key);
+int rbMultisetRemove(RBTree *rbTree, int key, int copies);
+int rbMultisetCount(RBTree *rbTree, int key);
+void rbAddCopies(RBTree *rbTree, RBTNode *node, int copies);
+int rbMultisetRangeScan(RBTree *rbTree, int lo, int hi, int (*visit)(int key, int count, void *context),
+    void *context);
+#if RB_INTERVALS
+RBTNode *rbIntervalInsert(RBTree *rbTree, int low, int high);
+int rbIntervalDelete(RBTree *rbTree, int low, int high);
+RBTNode *rbIntervalSearch(RBTree *rbTree, int low, int high);
+int rbIntervalScan(RBTree *rbTree, int low, int high, int (*visit)(int low, int high, void *context), void *context);
+int rbIntervalScanSubtree(RBTree *rbTree, RBTNode *node, int low, int high,
+    int (*visit)(int low, int high, void *context), void *context, int *count);
+#endif
 void leftRotate(RBTree *rbTree, RBTNode *node);
 void rightRotate(RBTree *rbTree, RBTNode *node);
 void rbTreeInsert(RBTree *rbTree, RBTNode *newNode);
-void rbInsertFixUp(RBTree *rbTree, RBTNode *newNode);
-void rbTransplant(RBTree *rbTree, RBTNode **u, RBTNode **v);
+int rbInsertFixUp(RBTree *rbTree, RBTNode *newNode);
+void rbtTransplant(RBTree *rbTree, RBTNode **u, RBTNode **v);
 void treeDelete(RBTree *rbTree, RBTNode *node);
+void rbDeleteFixUp(RBTree *rbTree, RBTNode *node);
+int rbTreeCheck(RBTree *rbTree);
+int rbSubtreeCheck(RBTree *rbTree, RBTNode *node, long lo, long hi, int *count, int *height);
+int rbTreeHeight(RBTree *rbTree);
+#if RB_ORDER_STATISTICS
+RBTNode *rbSelect(RBTree *rbTree, int k);
+int rbRank(RBTree *rbTree, int key);
+int rbPercentile(RBTree *rbTree, double percent, int *key);
+#endif
 void treeDeleteAll(RBTree *rbTree, RBTNode **root);
+void rbIteratorInit(RBTree *rbTree, RBIterator *iterator);
+int rbIteratorNext(RBIterator *iterator, int *key);
+int rbTreeExport(RBIterator *iterator, int *buffer, int capacity);
+void rbFingerInit(RBTree *rbTree, RBFinger *finger);
+RBTNode *rbFingerClimb(RBFinger *finger, int key, RBTNode **bound);
+RBTNode *rbFingerSearch(RBFinger *finger, int key);
+RBTNode *rbFingerInsert(RBFinger *finger, int key);
+void rbInsertSortedBatch(RBTree *rbTree, const int *keys, int n);
+RBBufferedTree *rbBufferedCreate(int capacity);
+void rbBufferedDestroy(RBBufferedTree *buffered);
+void rbBufferedInsert(RBBufferedTree *buffered, int key);
+void rbBufferedDelete(RBBufferedTree *buffered, int key);
+void rbBufferedAppend(RBBufferedTree *buffered, int key, int insert);
+int rbBufferedSearch(RBBufferedTree *buffered, int key);
+void rbBufferedMerge(RBBufferedTree *buffered);
+int rbCompareWriteOps(const void *a, const void *b);
+RBTree *rbTreeCreate(void);
+RBTree *rbTreeCreateShared(RBTree *rbTree);
+void rbTreeDestroy(RBTree *rbTree);
+RBTNode *rbNodeAlloc(RBTree *rbTree, int item);
+void rbNodeFree(RBTree *rbTree, RBTNode *node);
+void rbTreeBuildSorted(RBTree *rbTree, const int *keys, int n, int unique);
+RBTNode *rbBuildSubtree(RBTree *rbTree, const int *keys, const int *counts, int lo, int hi, int depth,
+    int redDepth);
+int rbBlackHeight(RBTree *rbTree);
+int rbJoin(RBTree *rbTree, int key, RBTree *other);
+RBTree *rbSplit(RBTree *rbTree, int key);
+RBTNode *rbJoinSubtrees(RBTree *rbTree, RBTNode *left, int leftHeight, RBTNode *middle, RBTNode *right, int rightHeight,
+    int *height);
+void rbSplitSubtree(RBTree *rbTree, RBTNode *node, int height, int key, RBTNode **less, int *lessHeight,
+    RBTNode **notLess, int *notLessHeight, RBTNode **match);
+void rbSplitLast(RBTree *rbTree, RBTNode *node, int height, RBTNode **rest, int *restHeight, RBTNode **last);
+void rbDetachChildren(RBTree *rbTree, RBTNode *node, int height, int *leftHeight, int *rightHeight);
+RBTNode *rbJoinPair(RBTree *rbTree, RBTNode *left, int leftHeight, RBTNode *right, int rightHeight, int *height);
+RBThreadPool *rbThreadPoolCreate(int count);
+void rbThreadPoolDestroy(RBThreadPool *threads);
+void *rbWorkerMain(void *arg);
+int rbWorkerPush(RBWorker *worker, RBSetTask *task);
+int rbWorkerPop(RBWorker *worker, RBSetTask *task);
+RBSetTask *rbWorkerSteal(RBWorker *worker);
+int rbTreeUnion(RBTree *rbTree, RBTree *other, RBThreadPool *threads);
+int rbTreeIntersection(RBTree *rbTree, RBTree *other, RBThreadPool *threads);
+int rbTreeDifference(RBTree *rbTree, RBTree *other, RBThreadPool *threads);
+int rbSetOperation(RBTree *rbTree, RBTree *other, char op, RBThreadPool *threads);
+void rbSetRecurse(RBWorker *worker, RBSetTask *task);
+void rbSetRun(RBWorker *worker, RBSetTask *task);
+void rbSetDiscard(RBTree *rbTree, RBWorker *worker, RBTNode *node);
+RBRcuTree *rbRcuTreeCreate(void);
+void rbRcuTreeDestroy(RBRcuTree *tree);
+void rbPSubtreeFree(RBPNode *node);
+RBRcuReader *rbRcuRegister(RBRcuTree *tree);
+void rbRcuUnregister(RBRcuReader *reader);
+void rbRcuReadLock(RBRcuReader *reader);
+void rbRcuReadUnlock(RBRcuReader *reader);
+int rbRcuSearch(RBRcuReader *reader, int key);
+int rbRcuRangeScan(RBRcuReader *reader, int lo, int hi, int (*visit)(int key, void *context), void *context);
+int rbRcuInsert(RBRcuTree *tree, int key);
+int rbRcuDelete(RBRcuTree *tree, int key);
+RBPNode *rbPInsert(RBPStore *store, RBPNode *root, int key);
+RBPNode *rbPDelete(RBPStore *store, RBPNode *root, int key, int *found);
+RBPNode *rbPNodeAlloc(RBPStore *store, int item);
+RBPNode *rbPNodeCopy(RBPStore *store, RBPNode *node);
+void rbPNodeDrop(RBPStore *store, RBPNode *node);
+void rbPNodeRelease(RBPStore *store, RBPNode *node);
+RBPStore *rbPStoreCreate(void);
+void rbPStoreDestroy(RBPStore *store);
+RBVersion *rbVersionCreate(RBPStore *store);
+RBVersion *rbVersionWrap(RBPStore *store, RBPNode *root, int count);
+RBVersion *rbVersionInsert(RBVersion *version, int key);
+RBVersion *rbVersionDelete(RBVersion *version, int key);
+RBVersion *rbVersionRetain(RBVersion *version);
+void rbVersionRelease(RBVersion *version);
+int rbVersionSearch(RBVersion *version, int key);
+int rbPRangeScan(RBPNode *root, int lo, int hi, int (*visit)(int key, void *context), void *context);
+RBPNode *rbPRotateLeft(RBPNode *node);
+RBPNode *rbPRotateRight(RBPNode *node);
+void rbPReplaceChild(RBPNode **path, int depth, RBPNode **root, RBPNode *old, RBPNode *node);
+void rbRcuPublish(RBRcuTree *tree, RBPNode *root);
+RBTDTree *rbtdTreeCreate(int concurrent);
+void rbtdTreeDestroy(RBTDTree *tree);
+RBTDNode *rbtdNodeAlloc(int item);
+void rbtdAcquire(RBTDLocks *locks, RBTDNode *node);
+void rbtdRelease(RBTDLocks *locks, RBTDNode **keep, int count);
+RBTDNode *rbtdRotate(RBTDNode *node, int dir);
+RBTDNode *rbtdRotateDouble(RBTDNode *node, int dir);
+int rbtdSearch(RBTDTree *tree, int key);
+int rbtdInsert(RBTDTree *tree, int key);
+int rbtdDelete(RBTDTree *tree, int key);
+int rbtdCheck(RBTDTree *tree, int *count);
+int rbtdSubtreeCheck(RBTDNode *node, long lo, long hi, int *count);
+RBCTree *rbcTreeCreate(uint32_t capacity);
+void rbcTreeDestroy(RBCTree *tree);
+uint32_t rbcNodeAlloc(RBCTree *tree, int item);
+uint32_t rbcIterativeTreeSearch(RBCTree *tree, int key);
+void rbcLeftRotate(RBCTree *tree, uint32_t node);
+void rbcRightRotate(RBCTree *tree, uint32_t node);
+void rbcTreeInsert(RBCTree *tree, int item);
+void rbcInsertFixUp(RBCTree *tree, uint32_t node);
+int rbTreeWriteImage(RBTree *rbTree, const char *path);
+RBImage *rbImageOpen(const char *path, int verify);
+void rbImageClose(RBImage *image);
+RBCTree *rbImageThaw(RBImage *image, uint32_t room);
+uint64_t rbImageChecksum(const RBCNode *nodes, uint32_t count);
+int rbImageCheckLinks(const RBCNode *nodes, uint32_t count);
+RBSnapshot *rbTreeFreeze(RBTree *rbTree);
+void rbSnapshotDestroy(RBSnapshot *snapshot);
+int rbSnapshotBlockRank(const int *block, int key);
+int rbSnapshotLowerBound(const RBSnapshot *snapshot, int key);
+int rbSnapshotSearch(const RBSnapshot *snapshot, int key);
+int rbSnapshotSuccessor(const RBSnapshot *snapshot, int key, int *successor);
+int rbSnapshotRange(const RBSnapshot *snapshot, int lo, int hi, const int **first);
+int rbBatchMain(int argc, char *argv[]);
+long rbRunBatch(RBTree *rbTree, FILE *in, FILE *out, int binary);
+int rbExecuteCommand(RBTree *rbTree, const RBCommand *command, RBWriter *writer);
+int rbReaderPeek(RBReader *reader);
+int rbReadInt(RBReader *reader, int *value);
+int rbReadTextCommand(RBReader *reader, RBCommand *command);
+int rbReadBinaryCommand(RBReader *reader, RBCommand *command);
+void rbWriteChar(RBWriter *writer, char c);
+void rbWriteInt(RBWriter *writer, int value);
+void rbWriterFlush(RBWriter *writer);
+int rbWriteKey(int key, void *writer);
+int rbWriteKeyCopies(int key, int count, void *writer);
+int rbBenchMain(int argc, char *argv[]);
+double rbNow(void);
+uint64_t rbRandom(uint64_t *state);
+int *rbShuffledKeys(int n, int stride, uint64_t *state);
+void rbBenchSearch(int n);
+void rbBenchCompact(int n);
+void rbBenchSnapshot(int n);
+int *rbBenchKeys(const char *dist, int n, uint64_t *state);
+int *rbBenchZipf(int n, int count, uint64_t *state);
+int rbBenchZipfKey(int r);
+int rbCompareDoubles(const void *a, const void *b);
+double rbQuantile(double *samples, int count, double q);
+void rbBenchReport(const char *dist, int n, const char *op, double elapsed, double *samples, int count, int height);
+void rbBenchSuite(int n);
+void rbBenchSetOps(int n);
+void rbBenchSetInputs(RBTree *rbTree, RBTree *other, int *keys, int n);
+void rbBenchRcu(int n);
+void *rbBenchRcuReader(void *arg);
+void *rbBenchRcuWriter(void *arg);
+void rbBenchVersions(int n);
+void rbBenchImage(int n);
+void rbBenchTyped(int n);
+void rbBenchSkewed(int n);
+void rbBenchMultiset(int n);
+void rbBenchHotCache(int n);
+void rbBenchFinger(int n);
+void rbBenchBuffered(int n);
+void rbBenchTopDown(int n);
+void *rbBenchTopDownWriter(void *arg);
+#if RB_INTERVALS
+void rbBenchIntervals(int n);
+int rbBenchCountInterval(int low, int high, void *count);
+#endif
+
+#if RB_STATS
+static _Thread_local RBStatsBlock rbStatsLocal;
+static RBStatsBlock *rbStatsBlocks; //Blocks of the threads that are still running
+static RBStats rbStatsExited; //Totals of the threads that have exited
+static pthread_mutex_t rbStatsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t rbStatsOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t rbStatsKey; //Only used for its destructor, which folds a thread's counts in when it exits
+#endif
 
-int main(){
+int main(int argc, char *argv[]){
 	int c, i;
 	c = 1;
 
-	RBTNode *node, *nil;
     RBTree *rbTree;
+    RBCommand command;
+    static RBWriter writer;
 
-    nil = malloc(sizeof(RBTNode));
-    rbTree = malloc(sizeof(RBTree));
-    rbTree->nil = nil;
-    rbTree->nil->color = 0; //Set SentinelNode Color to Black
-    rbTree->nil->left = rbTree->nil;
-    rbTree->nil->right = rbTree->nil;
-    rbTree->nil->parent = rbTree->nil;
-    rbTree->nil->item = 0;
-    rbTree->root = rbTree->nil;
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return rbBenchMain(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "batch") == 0) {
+        return rbBatchMain(argc - 2, argv + 2);
+    }
+    //The menu below is a front end to the same engine that runs batches, one command at a time
+    writer.out = stdout;
+    writer.len = 0;
+
+    rbTree = rbTreeCreate();
 
 	printf("1: Insert an integer into the binary search tree;\n");
 	printf("2: Print the in-order treewalk of the binary search tree;\n");
@@ -63,30 +1085,31 @@ int main(){
 	while (c != 0)
 	{
 		printf("Please input your choice(1/2/3/4/0): ");
-		scanf("%d", &c);
+		if (scanf("%d", &c) != 1) {
+            c = 0;
+        }
 
 		switch (c)
 		{
 		case 1:
 			printf("Input an integer that you want to insert into the Binary Search Tree: ");
 			scanf("%d", &i);
-			node = malloc(sizeof(RBTNode));
-            node->item = i;
-            node->parent = rbTree->nil;
-            node->left = rbTree->nil;
-            node->right = rbTree->nil;
-            node->color = 1;
-            rbTreeInsert(rbTree, node);
+            command.op = 'i';
+            command.a = i;
+            rbExecuteCommand(rbTree, &command, NULL);
 			break;
 		case 2:
 			printf("The resulting in-order treewalk of the Binary Search Tree is: \n");
-			inOrderTreeWalk(rbTree, rbTree->root);
-            printf("\n");
+            command.op = 'p';
+            rbExecuteCommand(rbTree, &command, &writer);
+            rbWriterFlush(&writer);
 			break;
         case 3:
             printf("Input an integer that you want to search for: ");
             scanf("%d", &i);
-            if (rbIterativeTreeSearch(rbTree->root, i)) {
+            command.op = 's';
+            command.a = i;
+            if (rbExecuteCommand(rbTree, &command, NULL)) {
                 printf("Integer found!\n");
             } else {
                 printf("Integer not in Binary Search Tree!\n");
@@ -95,19 +1118,16 @@ int main(){
         case 4:
             printf("Input an integer that you want to remove: ");
             scanf("%d", &i);
-            if ((node = rbIterativeTreeSearch(rbTree->root, i))) {
-                treeDelete(rbTree, node);
+            command.op = 'd';
+            command.a = i;
+            if (rbExecuteCommand(rbTree, &command, NULL)) {
                 printf("Integer successfully removed!\n");
             } else {
                 printf("Error. Integer not in Binary Search Tree!\n");
             }
             break;
 		case 0:
-			if (rbTree->root != rbTree->nil) {
-                treeDeleteAll(rbTree, &(rbTree->root));
-            }
-            free(rbTree->nil);
-            free(rbTree);
+            rbTreeDestroy(rbTree); //Drops every slab at once instead of freeing node by node
 			break;
 		default:
 			printf("Choice unknown;\n");
@@ -117,103 +1137,594 @@ int main(){
 	return 0;
 }
 
-/*Print out all the item sin a binary search tree in a sorted order by a simple recursive algorithm*/
+/*Print out all the items in the subtree rooted at node in sorted order. The walk follows successors through the parent
+pointers instead of recursing, and the output is collected in one large buffer instead of one printf per item*/
 void inOrderTreeWalk(RBTree *rbTree, RBTNode *node) {
-    //Perform an in order tree walk by recursively traversing the tree, going left whenever possible
-    if (node != rbTree->nil) {
-        inOrderTreeWalk(rbTree, node->left);
-        printf("%d ", node->item);
-        inOrderTreeWalk(rbTree, node->right);
+    static RBWriter writer;
+    RBTNode *stop, *child;
+    if (node == rbTree->nil) {
+        return;
+    }
+    writer.out = stdout;
+    writer.len = 0;
+    stop = node->parent; //Climbing out of the subtree ends the walk
+    node = rbTreeMin(rbTree, node);
+    while (node != stop) {
+        rbWriteInt(&writer, node->item);
+        rbWriteChar(&writer, ' ');
+        if (node->right != rbTree->nil) {
+            node = rbTreeMin(rbTree, node->right);
+        } else {
+            do {
+                child = node;
+                node = node->parent;
+            } while (node != stop && child == node->right);
+        }
+    }
+    rbWriterFlush(&writer);
+    return;
+}
+
+#if RB_STATS
+/*Link the calling thread's counters into the list that rbStatsCollect reads, and return them*/
+RBStatsBlock *rbStatsRegister(void) {
+    pthread_once(&rbStatsOnce, rbStatsCreateKey);
+    pthread_mutex_lock(&rbStatsLock);
+    rbStatsLocal.next = rbStatsBlocks;
+    rbStatsBlocks = &rbStatsLocal;
+    rbStatsLocal.registered = 1;
+    pthread_mutex_unlock(&rbStatsLock);
+    pthread_setspecific(rbStatsKey, &rbStatsLocal);
+    return &rbStatsLocal;
+}
+
+void rbStatsCreateKey(void) {
+    pthread_key_create(&rbStatsKey, rbStatsThreadExit);
+    return;
+}
+
+/*Destructor of rbStatsKey. Adds the counters of an exiting thread to the totals and unlinks them before they go away*/
+void rbStatsThreadExit(void *block) {
+    RBStatsBlock **link;
+    pthread_mutex_lock(&rbStatsLock);
+    rbStatsAdd(&rbStatsExited, &(((RBStatsBlock *)block)->stats));
+    for (link = &rbStatsBlocks; *link != NULL; link = &((*link)->next)) {
+        if (*link == block) {
+            *link = ((RBStatsBlock *)block)->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rbStatsLock);
+    return;
+}
+#endif
+
+/*Store in stats the sum of the counters of every thread, running or exited. Counters of threads that are still running
+are read while they may change, so they can be a few operations behind. All zero unless compiled with RB_STATS*/
+void rbStatsCollect(RBStats *stats) {
+    memset(stats, 0, sizeof(RBStats));
+#if RB_STATS
+    RBStatsBlock *block;
+    pthread_mutex_lock(&rbStatsLock);
+    rbStatsAdd(stats, &rbStatsExited);
+    for (block = rbStatsBlocks; block != NULL; block = block->next) {
+        rbStatsAdd(stats, &(block->stats));
+    }
+    pthread_mutex_unlock(&rbStatsLock);
+#endif
+    return;
+}
+
+/*Zero the counters of every thread. Meant to be called while no other thread is counting*/
+void rbStatsReset(void) {
+#if RB_STATS
+    RBStatsBlock *block;
+    pthread_mutex_lock(&rbStatsLock);
+    memset(&rbStatsExited, 0, sizeof(RBStats));
+    for (block = rbStatsBlocks; block != NULL; block = block->next) {
+        memset(&(block->stats), 0, sizeof(RBStats));
+    }
+    pthread_mutex_unlock(&rbStatsLock);
+#endif
+    return;
+}
+
+/*Add every counter of stats to total*/
+void rbStatsAdd(RBStats *total, const RBStats *stats) {
+    int i;
+    total->searches += stats->searches;
+    total->searchComparisons += stats->searchComparisons;
+    total->inserts += stats->inserts;
+    total->deletes += stats->deletes;
+    total->leftRotations += stats->leftRotations;
+    total->rightRotations += stats->rightRotations;
+    total->slabAllocations += stats->slabAllocations;
+    total->slabSeconds += stats->slabSeconds;
+    for (i = 0; i < RB_STATS_DEPTHS; i++) {
+        total->searchDepth[i] += stats->searchDepth[i];
+        total->insertDepth[i] += stats->insertDepth[i];
+    }
+    for (i = 0; i < RB_STATS_FIXUPS; i++) {
+        total->insertFixups[i] += stats->insertFixups[i];
+        total->deleteFixups[i] += stats->deleteFixups[i];
+    }
+    return;
+}
+
+/*Print stats to out, either as one JSON object on one line or as indented text. Histograms are cut after their last
+nonzero bucket*/
+void rbStatsPrint(const RBStats *stats, FILE *out, int json) {
+    static const char *names[] = {"search_depth", "insert_depth", "insert_fixups", "delete_fixups"};
+    const uint64_t *histograms[4];
+    int h, i, length, sizes[4] = {RB_STATS_DEPTHS, RB_STATS_DEPTHS, RB_STATS_FIXUPS, RB_STATS_FIXUPS};
+    histograms[0] = stats->searchDepth;
+    histograms[1] = stats->insertDepth;
+    histograms[2] = stats->insertFixups;
+    histograms[3] = stats->deleteFixups;
+    fprintf(out, json ? "{\"enabled\":%d,\"searches\":%llu,\"search_comparisons\":%llu,\"comparisons_per_search\":%.2f,"
+        "\"inserts\":%llu,\"deletes\":%llu,\"left_rotations\":%llu,\"right_rotations\":%llu,\"slab_allocations\":%llu,"
+        "\"slab_seconds\":%.6f" : "enabled %d\nsearches %llu\nsearch_comparisons %llu\ncomparisons_per_search %.2f\n"
+        "inserts %llu\ndeletes %llu\nleft_rotations %llu\nright_rotations %llu\nslab_allocations %llu\n"
+        "slab_seconds %.6f\n", RB_STATS, (unsigned long long)stats->searches,
+        (unsigned long long)stats->searchComparisons,
+        stats->searches > 0 ? (double)stats->searchComparisons / stats->searches : 0.0,
+        (unsigned long long)stats->inserts, (unsigned long long)stats->deletes,
+        (unsigned long long)stats->leftRotations, (unsigned long long)stats->rightRotations,
+        (unsigned long long)stats->slabAllocations, stats->slabSeconds);
+    for (h = 0; h < 4; h++) {
+        for (length = sizes[h]; length > 0 && histograms[h][length - 1] == 0; length--)
+            ;
+        fprintf(out, json ? ",\"%s\":[" : "%s", names[h]);
+        for (i = 0; i < length; i++) {
+            fprintf(out, "%s%llu", json ? (i > 0 ? "," : "") : " ", (unsigned long long)histograms[h][i]);
+        }
+        fprintf(out, json ? "]" : "\n");
+    }
+    if (json) {
+        fprintf(out, "}\n");
     }
     return;
 }
 
 /*Given a pointer to the root of the tree and a key, return a pointer to the node with item key if one exists,
-otherwise return NULL*/
-RBTNode *rbTreeSearch(RBTNode *node, int key) {
-    //If we reach a NULL node or we find the key, return a pointer to the current node
-    if (node == NULL || key == node->item) {
+otherwise return nil*/
+RBTNode *rbTreeSearch(RBTree *rbTree, RBTNode *node, int key) {
+    //If we reach the sentinel or we find the key, return a pointer to the current node
+    if (node == rbTree->nil || key == node->item) {
         return node;
     }
     //Otherwise, check the left subtree if key is less than the current node item and the right subtree
     //if key is more than the current node item
     if (key < node->item) {
-        return rbTreeSearch(node->left, key);
+        return rbTreeSearch(rbTree, node->left, key);
     } else {
-        return rbTreeSearch(node->right, key);
+        return rbTreeSearch(rbTree, node->right, key);
     }
 }
 
 /*Given a pointer to the root of the tree and a key, return a pointer to the node with item key if one exists,
-otherwise return NULL*/
-RBTNode *rbIterativeTreeSearch(RBTNode *node, int key) {
+otherwise return nil*/
+RBTNode *rbIterativeTreeSearch(RBTree *rbTree, RBTNode *node, int key) {
+#if RB_STATS
+    int depth = 0;
+#endif
     //Iteratively perform the search instead by manipulating the pointer. More efficient on most computers.
-    while (node != NULL && key != node->item) {
+    while (node != rbTree->nil && key != node->item) {
+#if RB_STATS
+        depth++;
+#endif
         if (key < node->item) {
             node = node->left;
         } else {
             node = node->right;
         }
     }
+#if RB_STATS
+    //Two comparisons per node passed, and one more at the node that was found
+    depth += node != rbTree->nil;
+    RB_STAT(searches);
+    RB_STAT_ADD(searchComparisons, 2 * depth - (node != rbTree->nil));
+    RB_STAT_BUCKET(searchDepth, depth, RB_STATS_DEPTHS);
+#endif
+    return node;
+}
+
+/*Given an array of n keys, store in results[i] a pointer to the node with item keys[i] if one exists, otherwise nil.
+The searches are run in groups of RB_BATCH_GROUP that descend one level at a time in lock-step. Each step prefetches
+the next node of every search in the group, so the cache misses of the whole group overlap instead of being paid one
+after the other as in a loop over rbIterativeTreeSearch*/
+void rbTreeSearchBatch(RBTree *rbTree, const int *keys, int n, RBTNode **results) {
+    RBTNode *cur[RB_BATCH_GROUP];
+    int base, i, size, active;
+    for (base = 0; base < n; base += RB_BATCH_GROUP) {
+        size = n - base < RB_BATCH_GROUP ? n - base : RB_BATCH_GROUP;
+        for (i = 0; i < size; i++) {
+            cur[i] = rbTree->root;
+        }
+        RB_PREFETCH(rbTree->root);
+        //Keep stepping every unfinished search down one level until all of them reach their key or the sentinel
+        do {
+            active = 0;
+            for (i = 0; i < size; i++) {
+                if (cur[i] != rbTree->nil && cur[i]->item != keys[base + i]) {
+                    cur[i] = keys[base + i] < cur[i]->item ? cur[i]->left : cur[i]->right;
+                    RB_PREFETCH(cur[i]);
+                    active = 1;
+                }
+            }
+        } while (active);
+        for (i = 0; i < size; i++) {
+            results[base + i] = cur[i];
+        }
+    }
+    return;
+}
+
+/*Put a hot-key cache with the given number of sets in front of rbCachedSearch, or remove the cache if sets is 0. sets
+is rounded up to a power of two, and to at least 2 so that the sets fill whole cache lines. A previous cache is
+dropped along with its counters*/
+void rbCacheEnable(RBTree *rbTree, int sets) {
+    RBCache *cache;
+    int bits = 1;
+    if (rbTree->cache != NULL) {
+        free(rbTree->cache->sets);
+        free(rbTree->cache);
+        rbTree->cache = NULL;
+    }
+    if (sets <= 0) {
+        return;
+    }
+    while ((1 << bits) < sets && bits < 30) {
+        bits++;
+    }
+    cache = malloc(sizeof(RBCache));
+    cache->size = 1 << bits;
+    cache->shift = 32 - bits;
+    cache->sets = aligned_alloc(RB_CACHE_LINE, cache->size * sizeof(RBCacheSet));
+    cache->hits = cache->misses = cache->invalidations = 0;
+    rbTree->cache = cache;
+    rbCacheClear(rbTree);
+    return;
+}
+
+/*Empty the hot-key cache, keeping its counters. Needed whenever nodes leave the tree other than through treeDelete, as
+they do in rbJoin, rbSplit, the set operations and rbTreeBuildSorted*/
+void rbCacheClear(RBTree *rbTree) {
+    int i, way;
+    if (rbTree->cache == NULL) {
+        return;
+    }
+    for (i = 0; i < rbTree->cache->size; i++) {
+        for (way = 0; way < RB_CACHE_WAYS; way++) {
+            rbTree->cache->sets[i].nodes[way] = NULL;
+        }
+        rbTree->cache->sets[i].recent = 0;
+    }
+    return;
+}
+
+/*Same as rbIterativeTreeSearch from the root, but a key found in the hot-key cache is returned without descending the
+tree. Keys that miss are searched for and, if present, replace the least recently used way of their set. Without a
+cache this is a plain search*/
+RBTNode *rbCachedSearch(RBTree *rbTree, int key) {
+    RBCache *cache = rbTree->cache;
+    RBCacheSet *set;
+    RBTNode *node;
+    int way;
+    if (cache == NULL) {
+        return rbIterativeTreeSearch(rbTree, rbTree->root, key);
+    }
+    set = &(cache->sets[RB_CACHE_SET(cache, key)]);
+    for (way = 0; way < RB_CACHE_WAYS; way++) {
+        if (set->nodes[way] != NULL && set->keys[way] == key) {
+            set->recent = way;
+            cache->hits++;
+            return set->nodes[way];
+        }
+    }
+    cache->misses++;
+    node = rbIterativeTreeSearch(rbTree, rbTree->root, key);
+    if (node != rbTree->nil) {
+        way = (set->recent + 1) % RB_CACHE_WAYS;
+        set->keys[way] = key;
+        set->nodes[way] = node;
+        set->recent = way;
+    }
     return node;
 }
 
+/*Drop the cache entry pointing to node, if there is one. Called by treeDelete. Only node's own entry can go stale:
+when the successor takes node's place it moves as a whole, so the entry of its key still points to the right node.
+With repeated keys the entry may point to another node holding the same item, which then stays valid*/
+void rbCacheInvalidate(RBTree *rbTree, RBTNode *node) {
+    RBCacheSet *set;
+    int way;
+    if (rbTree->cache == NULL) {
+        return;
+    }
+    set = &(rbTree->cache->sets[RB_CACHE_SET(rbTree->cache, node->item)]);
+    for (way = 0; way < RB_CACHE_WAYS; way++) {
+        if (set->nodes[way] == node) {
+            set->nodes[way] = NULL;
+            rbTree->cache->invalidations++;
+        }
+    }
+    return;
+}
+
 /*Given a pointer to the root of a subtree, return a pointer to the minimum item in the subtree*/
-RBTNode *rbTreeMin(RBTNode *node) {
+RBTNode *rbTreeMin(RBTree *rbTree, RBTNode *node) {
     //Simply manipulate the pointer to pointer to the left child while it exists
-    while (node->left != NULL) {
+    while (node->left != rbTree->nil) {
         node = node->left;
     }
     return node;
 }
 
 /*Given a pointer to the root of a subtree, return a pointer to the maximum item in the subtree*/
-RBTNode *rbTreeMax(RBTNode *node) {
+RBTNode *rbTreeMax(RBTree *rbTree, RBTNode *node) {
     //Simply manipulate the pointer to pointer to the right child while it exists
-    while (node->right != NULL) {
+    while (node->right != rbTree->nil) {
         node = node->right;
     }
     return node;
 }
 
-/*Given a pointer to a node, return a pointer to the successor of that node if it exists and NULL if the node is
+/*Given a pointer to a node, return a pointer to the successor of that node if it exists and nil if the node is
 already the largest item in the tree*/
-RBTNode *rbTreeSuccessor(RBTNode *node) {
+RBTNode *rbTreeSuccessor(RBTree *rbTree, RBTNode *node) {
     RBTNode *successor;
     //If the right subtree is nonempty, then simply return the smallest child in the right subtree
-    if (node->right != NULL) {
-        return rbTreeMin(node->right);
+    if (node->right != rbTree->nil) {
+        return rbTreeMin(rbTree, node->right);
     }
     //Otherwise, if the right subtree is empty, then the successor is the lowest ancestor of node whose left
     //child is also an ancestor of node
     successor = node->parent;
-    while (successor != NULL && node == successor->right) {
+    while (successor != rbTree->nil && node == successor->right) {
         node = successor;
         successor = successor->parent;
     }
     return successor;
 }
 
-/*Given a pointer to a node, return a pointer to the successor of that node if it exists and NULL if the node is
-already the largest item in the tree*/
-RBTNode *rbTreePredecessor(RBTNode *node) {
+/*Given a pointer to a node, return a pointer to the predecessor of that node if it exists and nil if the node is
+already the smallest item in the tree*/
+RBTNode *rbTreePredecessor(RBTree *rbTree, RBTNode *node) {
     RBTNode *predecessor;
     //If the left subtree is nonempty, then simply return the largest child in the left subtree
-    if (node->left != NULL) {
-        return rbTreeMax(node->left);
+    if (node->left != rbTree->nil) {
+        return rbTreeMax(rbTree, node->left);
     }
     //Otherwise, if the left subtree is empty, then the predecessor is the greatest ancestor of node whose right
     //child is also an ancestor of node
     predecessor = node->parent;
-    while (predecessor != NULL && node == predecessor->left) {
+    while (predecessor != rbTree->nil && node == predecessor->left) {
         node = predecessor;
         predecessor = predecessor->parent;
     }
     return predecessor;
 }
 
+/*Given a key, return a pointer to the first node in sorted order whose item is not less than key, or nil if every item
+is less than key*/
+RBTNode *rbTreeLowerBound(RBTree *rbTree, int key) {
+    RBTNode *node = rbTree->root, *bound = rbTree->nil;
+    while (node != rbTree->nil) {
+        if (node->item >= key) {
+            //node qualifies, but there may be a smaller qualifying item on its left
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the first node in sorted order whose item is greater than key, or nil if there is
+none*/
+RBTNode *rbTreeUpperBound(RBTree *rbTree, int key) {
+    RBTNode *node = rbTree->root, *bound = rbTree->nil;
+    while (node != rbTree->nil) {
+        if (node->item > key) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the node with the largest item not greater than key, or nil if there is none*/
+RBTNode *rbTreeFloor(RBTree *rbTree, int key) {
+    RBTNode *node = rbTree->root, *bound = rbTree->nil;
+    while (node != rbTree->nil) {
+        if (node->item <= key) {
+            //node qualifies, but there may be a larger qualifying item on its right
+            bound = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return bound;
+}
+
+/*Given a key, return a pointer to the node with the smallest item not less than key, or nil if there is none. This is
+the lower bound under its usual name*/
+RBTNode *rbTreeCeiling(RBTree *rbTree, int key) {
+    return rbTreeLowerBound(rbTree, key);
+}
+
+/*Call visit on every item k with lo <= k <= hi in sorted order, passing context along, and return the number of items
+visited. The scan descends once to the lower bound of lo and then follows successors, so it costs O(log n + k) rather
+than a walk of the whole tree. visit may return nonzero to end the scan early*/
+int rbTreeRangeScan(RBTree *rbTree, int lo, int hi, int (*visit)(int key, void *context), void *context) {
+    RBTNode *node;
+    int count = 0;
+    for (node = rbTreeLowerBound(rbTree, lo); node != rbTree->nil && node->item <= hi;
+        node = rbTreeSuccessor(rbTree, node)) {
+        count++;
+        if (visit(node->item, context)) {
+            break;
+        }
+    }
+    return count;
+}
+
+/*Copy the items k with lo <= k <= hi into buffer in sorted order, stopping once capacity items have been copied, and
+return the number copied*/
+int rbTreeRangeCopy(RBTree *rbTree, int lo, int hi, int *buffer, int capacity) {
+    RBTNode *node;
+    int count = 0;
+    for (node = rbTreeLowerBound(rbTree, lo); count < capacity && node != rbTree->nil && node->item <= hi;
+        node = rbTreeSuccessor(rbTree, node)) {
+        buffer[count++] = node->item;
+    }
+    return count;
+}
+
+/*Add one copy of key to a multiset. A key that is already present only has its count incremented, so repeated keys
+cost a search and no allocation, and never add height or fixup work. Returns the number of copies of key afterwards*/
+int rbMultisetAdd(RBTree *rbTree, int key) {
+    RBTNode *node = rbCachedSearch(rbTree, key);
+    if (node != rbTree->nil) {
+        rbAddCopies(rbTree, node, 1);
+        return node->count;
+    }
+    rbTreeInsert(rbTree, rbNodeAlloc(rbTree, key));
+    return 1;
+}
+
+/*Remove up to copies copies of key from a multiset, or every copy if copies is 0. The node itself is deleted once its
+count drops to 0. Returns the number of copies removed*/
+int rbMultisetRemove(RBTree *rbTree, int key, int copies) {
+    RBTNode *node = rbCachedSearch(rbTree, key);
+    if (node == rbTree->nil) {
+        return 0;
+    }
+    if (copies > 0 && copies < node->count) {
+        rbAddCopies(rbTree, node, -copies);
+        return copies;
+    }
+    copies = node->count;
+    treeDelete(rbTree, node);
+    rbNodeFree(rbTree, node);
+    return copies;
+}
+
+/*Add copies, which may be negative, to the count of node, and to the size of node and of every ancestor of it*/
+void rbAddCopies(RBTree *rbTree, RBTNode *node, int copies) {
+    node->count += copies;
+#if RB_ORDER_STATISTICS
+    for (; node != rbTree->nil; node = node->parent) {
+        node->size += copies;
+    }
+#else
+    (void)rbTree;
+#endif
+    return;
+}
+
+/*Return the number of copies of key in the tree, 0 if it is absent*/
+int rbMultisetCount(RBTree *rbTree, int key) {
+    RBTNode *node = rbCachedSearch(rbTree, key);
+    return node == rbTree->nil ? 0 : node->count;
+}
+
+/*Like rbTreeRangeScan, but visit is called once per distinct key with its number of copies. Returns the total number
+of copies visited*/
+int rbMultisetRangeScan(RBTree *rbTree, int lo, int hi, int (*visit)(int key, int count, void *context),
+    void *context) {
+    RBTNode *node;
+    int count = 0;
+    for (node = rbTreeLowerBound(rbTree, lo); node != rbTree->nil && node->item <= hi;
+        node = rbTreeSuccessor(rbTree, node)) {
+        count += node->count;
+        if (visit(node->item, node->count, context)) {
+            break;
+        }
+    }
+    return count;
+}
+
+#if RB_INTERVALS
+/*Insert the interval [low, high] and return its node. Intervals are ordered by their low end, equal low ends going to
+the right like equal items do, and always get a node of their own even in a multiset*/
+RBTNode *rbIntervalInsert(RBTree *rbTree, int low, int high) {
+    RBTNode *node = rbNodeAlloc(rbTree, low);
+    node->high = high;
+    node->max = high;
+    rbTreeInsert(rbTree, node);
+    return node;
+}
+
+/*Remove one interval equal to [low, high]. Returns 1 if there was one*/
+int rbIntervalDelete(RBTree *rbTree, int low, int high) {
+    RBTNode *node;
+    for (node = rbTreeLowerBound(rbTree, low); node != rbTree->nil && node->item == low;
+        node = rbTreeSuccessor(rbTree, node)) {
+        if (node->high == high) {
+            treeDelete(rbTree, node);
+            rbNodeFree(rbTree, node);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*Return the node of some interval that overlaps [low, high], or nil if none does. This is INTERVAL-SEARCH of CLRS:
+when the left subtree reaches up to low, either it holds an overlapping interval or no interval on the right can
+overlap either, so a single path from the root is enough and the search is O(log n)*/
+RBTNode *rbIntervalSearch(RBTree *rbTree, int low, int high) {
+    RBTNode *node = rbTree->root;
+    while (node != rbTree->nil && (high < node->item || node->high < low)) {
+        if (node->left != rbTree->nil && node->left->max >= low) {
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return node;
+}
+
+/*Call visit on every interval that overlaps [low, high] in order of their low ends, passing context along, and return
+the number of intervals visited. visit may return nonzero to end the scan early. Subtrees whose max is below low are
+skipped, as are right subtrees past high, so the scan costs O(min(n, (k + 1) log n)) for k overlapping intervals*/
+int rbIntervalScan(RBTree *rbTree, int low, int high, int (*visit)(int low, int high, void *context), void *context) {
+    int count = 0;
+    rbIntervalScanSubtree(rbTree, rbTree->root, low, high, visit, context, &count);
+    return count;
+}
+
+/*Subroutine for rbIntervalScan. Adds the overlapping intervals of the subtree rooted at node to count and returns 1 if
+visit asked to stop. The recursion only follows paths of the tree, so it is at most as deep as the tree is high*/
+int rbIntervalScanSubtree(RBTree *rbTree, RBTNode *node, int low, int high,
+    int (*visit)(int low, int high, void *context), void *context, int *count) {
+    while (node != rbTree->nil && node->max >= low) {
+        if (rbIntervalScanSubtree(rbTree, node->left, low, high, visit, context, count)) {
+            return 1;
+        }
+        if (node->item > high) {
+            return 0; //Every interval from here on starts after high
+        }
+        if (node->high >= low) {
+            (*count)++;
+            if (visit(node->item, node->high, context)) {
+                return 1;
+            }
+        }
+        node = node->right;
+    }
+    return 0;
+}
+#endif
+
 void leftRotate(RBTree *rbTree, RBTNode *node) {
     RBTNode *rNode;
+    RB_STAT(leftRotations);
     rNode = node->right;
     node->right = rNode->left;
     if (rNode->left != rbTree->nil) {
@@ -229,11 +1740,17 @@ void leftRotate(RBTree *rbTree, RBTNode *node) {
     }
     rNode->left = node;
     node->parent = rNode;
+    //rNode now roots the subtree node used to root, and node lost rNode's right subtree
+    RB_UPDATE_SIZE(node);
+    RB_UPDATE_SIZE(rNode);
+    RB_UPDATE_MAX(node);
+    RB_UPDATE_MAX(rNode);
     return;
 }
 
 void rightRotate(RBTree *rbTree, RBTNode *node) {
     RBTNode *lNode;
+    RB_STAT(rightRotations);
     lNode = node->left;
     node->left = lNode->right;
     if (lNode->right != rbTree->nil) {
@@ -249,14 +1766,30 @@ void rightRotate(RBTree *rbTree, RBTNode *node) {
     }
     lNode->right = node;
     node->parent = lNode;
+    RB_UPDATE_SIZE(node);
+    RB_UPDATE_SIZE(lNode);
+    RB_UPDATE_MAX(node);
+    RB_UPDATE_MAX(lNode);
     return;
 }
 
 void rbTreeInsert(RBTree *rbTree, RBTNode *newNode) {
     RBTNode *parent = rbTree->nil, *cur = rbTree->root;
+#if RB_STATS
+    int depth = 0;
+#endif
     //Find a suitable position to insert the node
     while (cur != rbTree->nil) {
         parent = cur;
+#if RB_STATS
+        depth++;
+#endif
+#if RB_ORDER_STATISTICS
+        cur->size += newNode->count; //newNode will end up somewhere below cur
+#endif
+#if RB_INTERVALS
+        cur->max = RB_MAX(cur->max, newNode->high);
+#endif
         if (newNode->item < cur->item) {
             cur = cur->left;
         } else {
@@ -265,7 +1798,6 @@ void rbTreeInsert(RBTree *rbTree, RBTNode *newNode) {
     }
     newNode->parent = parent;
     if (parent == rbTree->nil) { //The tree was empty
-    printf("inserting\n");
         rbTree->root = newNode;
     } else if (newNode->item < parent->item) { //The newNode is less than the parent so set as left child
         parent->left = newNode;
@@ -273,12 +1805,15 @@ void rbTreeInsert(RBTree *rbTree, RBTNode *newNode) {
         parent->right = newNode;
     }
     newNode->color = 1; //Set newNode's color to red
+    RB_STAT(inserts);
+    RB_STAT_BUCKET(insertDepth, depth, RB_STATS_DEPTHS);
     rbInsertFixUp(rbTree, newNode);
     return;
 }
 
-/* Subroutine for rbTreeInsert, which checks for violations of red-black tree properties and corrects them accordingly */
-void rbInsertFixUp(RBTree *rbTree, RBTNode *newNode) {
+/* Subroutine for rbTreeInsert, which checks for violations of red-black tree properties and corrects them accordingly.
+Returns 1 if the black-height of the tree grew, which happens exactly when the root has to be recolored black */
+int rbInsertFixUp(RBTree *rbTree, RBTNode *newNode) {
     //The while loop maintains a three part invariant at the start of each iteration
     //a. newNode is red
     //b. If newNode is the root, then newNode->parent is black
@@ -286,9 +1821,16 @@ void rbInsertFixUp(RBTree *rbTree, RBTNode *newNode) {
     //  either property 2 or property 4. If the tree violates property 2, it is because newNode is the rot and is red. If it violates
     // property 4, it is because both newNode and newNode->parent are red.
     RBTNode *uncle;
+    int grew;
+#if RB_STATS
+    int iterations = 0;
+#endif
     //Keep looping while the parent is red, which violates Property 4. 
     //Also checks if newNode is the root, since root's parent is the sentinel node with color == black
     while (newNode->parent->color == 1) {
+#if RB_STATS
+        iterations++;
+#endif
         //Check if newNode->parent is the left child
         if (newNode->parent == newNode->parent->parent->left) {
             uncle = newNode->parent->parent->right;
@@ -318,46 +1860,86 @@ void rbInsertFixUp(RBTree *rbTree, RBTNode *newNode) {
                 newNode->parent->parent->color = 1; //Change newNode->grandparent to red
                 newNode = newNode->parent->parent; //Shift pointer two levels up
             } else {
-                if (newNode == newNode->parent->right) { //Otherwise, the uncle is black. Check if newNode is the right child.
+                if (newNode == newNode->parent->left) { //Otherwise, the uncle is black. Check if newNode is the left child.
                     newNode = newNode->parent;
-                    leftRotate(rbTree, newNode); //Perform a leftRotate on newNode's parent to turn case 2 to case 3;
+                    rightRotate(rbTree, newNode); //Perform a rightRotate on newNode's parent to turn case 2 to case 3;
                 }
                 newNode->parent->color = 0;
                 newNode->parent->parent->color = 1;
-                rightRotate(rbTree, newNode->parent->parent); //Perform a rightRotate on newNode's grandparent to correct violation of property 4
+                leftRotate(rbTree, newNode->parent->parent); //Perform a leftRotate on newNode's grandparent to correct violation of property 4
             } 
         }
     }
+    RB_STAT_BUCKET(insertFixups, iterations, RB_STATS_FIXUPS);
+    grew = rbTree->root->color == 1;
     rbTree->root->color = 0; //On exiting the loop, only property 2 can be violated. This line ensures the violation, if any, is corrected
-    return;
+    return grew;
 }
 
 //Subroutine used for treeDelete
 void rbtTransplant(RBTree *rbTree, RBTNode **u, RBTNode **v) {
-    if ((*u)->parent == NULL) {
+    if ((*u)->parent == rbTree->nil) {
         rbTree->root = *v;
     } else if (*u == (*u)->parent->left) {
         (*u)->parent->left = *v;
     } else {
         (*u)->parent->right = *v;
     }
-    if (*v != NULL) {
-        (*v)->parent = (*u)->parent;
-    }
+    //Unconditional, even when v is the sentinel, since rbDeleteFixUp climbs from v through its parent pointer
+    (*v)->parent = (*u)->parent;
     return;
 }
 
 /*Given a pointer to the root node as well as a pointer to the node to be removed, remove that node and modify the
-BinarySearchTree accordingly*/
+Red-Black Tree accordingly*/
 void treeDelete(RBTree *rbTree, RBTNode *node) {
-    RBTNode *successor;
+    RBTNode *successor, *replacement;
+    int removedColor;
+#if RB_INTERVALS
+    RBTNode *lowest; //Deepest node whose subtree changes. The max of it and of every node above it is recomputed
+#endif
+    if (rbTree->cache != NULL) {
+        rbCacheInvalidate(rbTree, node);
+    }
+#if RB_ORDER_STATISTICS
+    RBTNode *ancestor, *moved;
+    //Every ancestor of node loses its copies. When node has two children its successor moves up into its position, so
+    //the nodes between the two only lose the successor's copies, and node's own size already leaves out its copies
+    //once successor takes it over
+    if (node->left == rbTree->nil || node->right == rbTree->nil) {
+        ancestor = node->parent;
+    } else {
+        moved = rbTreeMin(rbTree, node->right);
+        for (ancestor = moved->parent; ancestor != node; ancestor = ancestor->parent) {
+            ancestor->size -= moved->count;
+        }
+    }
+    for (; ancestor != rbTree->nil; ancestor = ancestor->parent) {
+        ancestor->size -= node->count;
+    }
+#endif
+    //Track the color of the node that is actually removed from its position, along with the node that moves into
+    //that position, since removing a black node leaves an extra black to push up the tree
+    removedColor = node->color;
+#if RB_INTERVALS
+    lowest = node->parent;
+#endif
     if (node->left == rbTree->nil) {
+        replacement = node->right;
         rbtTransplant(rbTree, &node, &(node->right));
     } else if (node->right == rbTree->nil) {
+        replacement = node->left;
         rbtTransplant(rbTree, &node, &(node->left));
     } else {
-        successor = rbTreeMin(node->right);
-        if (successor->parent != node) {
+        successor = rbTreeMin(rbTree, node->right);
+        removedColor = successor->color;
+        replacement = successor->right;
+#if RB_INTERVALS
+        lowest = successor->parent == node ? successor : successor->parent;
+#endif
+        if (successor->parent == node) {
+            replacement->parent = successor; //Needed when replacement is the sentinel
+        } else {
             rbtTransplant(rbTree, &successor, &(successor->right));
             successor->right = node->right;
             successor->right->parent = successor;
@@ -365,17 +1947,4309 @@ void treeDelete(RBTree *rbTree, RBTNode *node) {
         rbtTransplant(rbTree, &node, &successor);
         successor->left = node->left;
         successor->left->parent = successor;
+        successor->color = node->color; //successor takes over node's position and color
+#if RB_ORDER_STATISTICS
+        successor->size = node->size;
+#endif
+    }
+#if RB_INTERVALS
+    //The fixup below only recolors and rotates, and rotations keep max up to date on their own
+    for (; lowest != rbTree->nil; lowest = lowest->parent) {
+        RB_UPDATE_MAX(lowest);
+    }
+#endif
+    RB_STAT(deletes);
+    if (removedColor == 0) {
+        rbDeleteFixUp(rbTree, replacement);
+    } else {
+        RB_STAT_BUCKET(deleteFixups, 0, RB_STATS_FIXUPS);
     }
     return;
 }
 
-void treeDeleteAll(RBTree *rbTree, RBTNode **root) {
-	if (*root != rbTree->nil) {
-		treeDeleteAll(rbTree, &((*root)->left));
-		treeDeleteAll(rbTree, &((*root)->right));
-		free(*root);
-		*root = NULL;
-	}
+/* Subroutine for treeDelete, which restores the red-black properties after a black node was removed. node carries an
+extra black which is moved up the tree until it reaches a red node, which is then colored black, or the root */
+void rbDeleteFixUp(RBTree *rbTree, RBTNode *node) {
+    RBTNode *sibling;
+#if RB_STATS
+    int iterations = 0;
+#endif
+    while (node != rbTree->root && node->color == 0) {
+#if RB_STATS
+        iterations++;
+#endif
+        if (node == node->parent->left) {
+            sibling = node->parent->right;
+            if (sibling->color == 1) { //Case 1: sibling is red, rotate so that the new sibling is black
+                sibling->color = 0;
+                node->parent->color = 1;
+                leftRotate(rbTree, node->parent);
+                sibling = node->parent->right;
+            }
+            if (sibling->left->color == 0 && sibling->right->color == 0) {
+                //Case 2: both of sibling's children are black, remove a black from node and sibling and move up
+                sibling->color = 1;
+                node = node->parent;
+            } else {
+                if (sibling->right->color == 0) { //Case 3: only sibling's left child is red, turn it into case 4
+                    sibling->left->color = 0;
+                    sibling->color = 1;
+                    rightRotate(rbTree, sibling);
+                    sibling = node->parent->right;
+                }
+                //Case 4: sibling's right child is red, a rotation at the parent absorbs the extra black
+                sibling->color = node->parent->color;
+                node->parent->color = 0;
+                sibling->right->color = 0;
+                leftRotate(rbTree, node->parent);
+                node = rbTree->root;
+            }
+        } else { //Otherwise, node is the right child. Then do the same with left and right exchanged.
+            sibling = node->parent->left;
+            if (sibling->color == 1) {
+                sibling->color = 0;
+                node->parent->color = 1;
+                rightRotate(rbTree, node->parent);
+                sibling = node->parent->left;
+            }
+            if (sibling->right->color == 0 && sibling->left->color == 0) {
+                sibling->color = 1;
+                node = node->parent;
+            } else {
+                if (sibling->left->color == 0) {
+                    sibling->right->color = 0;
+                    sibling->color = 1;
+                    leftRotate(rbTree, sibling);
+                    sibling = node->parent->left;
+                }
+                sibling->color = node->parent->color;
+                node->parent->color = 0;
+                sibling->left->color = 0;
+                rightRotate(rbTree, node->parent);
+                node = rbTree->root;
+            }
+        }
+    }
+    node->color = 0;
+    RB_STAT_BUCKET(deleteFixups, iterations, RB_STATS_FIXUPS);
     return;
 }
 
+/*Verify the red-black properties along with the parent links and key order of the whole tree, and check that the
+height is at most 2*log2(n+1). Returns the black-height of the tree, or -1 if any check fails*/
+int rbTreeCheck(RBTree *rbTree) {
+    int count = 0, height = 0, blackHeight;
+    long long bound;
+    if (rbTree->root->color != 0 || rbTree->nil->color != 0) {
+        return -1;
+    }
+    if ((blackHeight = rbSubtreeCheck(rbTree, rbTree->root, INT_MIN, INT_MAX, &count, &height)) < 0) {
+        return -1;
+    }
+    //height <= 2*log2(n+1) is the same as 2^height <= (n+1)^2
+    bound = (long long)(count + 1) * (count + 1);
+    if (height >= 62 || (1LL << height) > bound) {
+        return -1;
+    }
+    return blackHeight;
+}
+
+/*Subroutine for rbTreeCheck, which adds the number of nodes in the subtree to count, stores its height in height and
+returns its black-height, or -1 if the subtree violates a red-black or binary-search-tree property. Every key of the
+subtree must lie between lo and hi inclusive, since equal keys may end up on either side of each other*/
+int rbSubtreeCheck(RBTree *rbTree, RBTNode *node, long lo, long hi, int *count, int *height) {
+    int leftBlack, rightBlack, leftHeight, rightHeight;
+    if (node == rbTree->nil) {
+        *height = 0;
+        return 0;
+    }
+    (*count)++;
+    //Property 4: a red node only has black children
+    if (node->color == 1 && (node->left->color == 1 || node->right->color == 1)) {
+        return -1;
+    }
+    if (node->item < lo || node->item > hi || (node->left != rbTree->nil && node->left->parent != node) ||
+        (node->right != rbTree->nil && node->right->parent != node)) {
+        return -1;
+    }
+#if RB_ORDER_STATISTICS
+    if (node->size != node->left->size + node->right->size + node->count) {
+        return -1;
+    }
+#endif
+#if RB_INTERVALS
+    if (node->max != RB_MAX(node->high, RB_MAX(node->left->max, node->right->max))) {
+        return -1;
+    }
+#endif
+    leftBlack = rbSubtreeCheck(rbTree, node->left, lo, node->item, count, &leftHeight);
+    rightBlack = rbSubtreeCheck(rbTree, node->right, node->item, hi, count, &rightHeight);
+    //Property 5: both subtrees must have the same black-height
+    if (leftBlack < 0 || leftBlack != rightBlack) {
+        return -1;
+    }
+    *height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+    return leftBlack + (node->color == 0 ? 1 : 0);
+}
+
+/*Return the number of nodes on the longest root-to-leaf path. The walk is an in-order traversal through the parent
+pointers that tracks the depth as it goes, so it uses no stack even on a badly unbalanced tree*/
+int rbTreeHeight(RBTree *rbTree) {
+    RBTNode *node = rbTree->root, *child;
+    int depth = 1, height = 0;
+    if (node == rbTree->nil) {
+        return 0;
+    }
+    for (; node->left != rbTree->nil; depth++) {
+        node = node->left;
+    }
+    while (node != rbTree->nil) {
+        if (depth > height) {
+            height = depth;
+        }
+        if (node->right != rbTree->nil) {
+            //Move to the leftmost node of the right subtree
+            for (node = node->right, depth++; node->left != rbTree->nil; depth++) {
+                node = node->left;
+            }
+        } else {
+            //Climb until we arrive from a left child, the parent of which is the successor
+            do {
+                child = node;
+                node = node->parent;
+                depth--;
+            } while (node != rbTree->nil && child == node->right);
+        }
+    }
+    return height;
+}
+
+#if RB_ORDER_STATISTICS
+/*Return a pointer to the node holding the k-th smallest item, counting from 1, or nil if k is out of range. In a
+multiset every copy of a key has a rank of its own*/
+RBTNode *rbSelect(RBTree *rbTree, int k) {
+    RBTNode *node = rbTree->root;
+    while (node != rbTree->nil) {
+        //The copies of node are the items ranked left->size + 1 to left->size + count of its own subtree
+        if (k <= node->left->size) {
+            node = node->left;
+        } else if (k <= node->left->size + node->count) {
+            return node;
+        } else {
+            k -= node->left->size + node->count;
+            node = node->right;
+        }
+    }
+    return node;
+}
+
+/*Return the number of items in the tree that are less than key, whether or not key itself is present. In a multiset
+every copy counts*/
+int rbRank(RBTree *rbTree, int key) {
+    RBTNode *node = rbTree->root;
+    int rank = 0;
+    while (node != rbTree->nil) {
+        if (key <= node->item) {
+            node = node->left;
+        } else {
+            //node and its whole left subtree are less than key
+            rank += node->left->size + node->count;
+            node = node->right;
+        }
+    }
+    return rank;
+}
+
+/*Store in key the item at the given percentile (e.g. 50, 90 or 99) using the nearest-rank method, so that at least
+percent% of the items are less than or equal to it. Returns 0 if the tree is empty*/
+int rbPercentile(RBTree *rbTree, double percent, int *key) {
+    int n = rbTree->root->size, k;
+    if (n == 0) {
+        return 0;
+    }
+    k = (int)(percent / 100.0 * n);
+    if (k < percent / 100.0 * n) {
+        k++; //Round up to the next rank
+    }
+    if (k < 1) {
+        k = 1;
+    } else if (k > n) {
+        k = n;
+    }
+    *key = rbSelect(rbTree, k)->item;
+    return 1;
+}
+#endif
+
+/*Given a pointer to the root of a subtree, return every node in the subtree to the tree's node pool. Rather than
+recursing, left children are rotated up until the current node has none, at which point it can be freed and its right
+child becomes the current node. Every rotation moves one node onto the right spine, so this is O(n) with no stack*/
+void treeDeleteAll(RBTree *rbTree, RBTNode **root) {
+    RBTNode *node = *root, *next;
+    while (node != rbTree->nil) {
+        if (node->left == rbTree->nil) {
+            next = node->right; //Read before rbNodeFree reuses the right pointer for the free list
+            rbNodeFree(rbTree, node);
+        } else {
+            next = node->left;
+            node->left = next->right;
+            next->right = node;
+        }
+        node = next;
+    }
+    *root = rbTree->nil;
+    return;
+}
+
+/*Position the iterator on the smallest item in the tree*/
+void rbIteratorInit(RBTree *rbTree, RBIterator *iterator) {
+    iterator->tree = rbTree;
+    iterator->node = rbTree->root == rbTree->nil ? rbTree->nil : rbTreeMin(rbTree, rbTree->root);
+    return;
+}
+
+/*Store the next item in key and advance the iterator. Returns 0 once every item has been visited*/
+int rbIteratorNext(RBIterator *iterator, int *key) {
+    if (iterator->node == iterator->tree->nil) {
+        return 0;
+    }
+    *key = iterator->node->item;
+    iterator->node = rbTreeSuccessor(iterator->tree, iterator->node);
+    return 1;
+}
+
+/*Copy up to capacity of the next items into buffer and return how many were copied, which is less than capacity only
+once the walk is over. Calling this repeatedly streams a tree of any size through a fixed-size buffer*/
+int rbTreeExport(RBIterator *iterator, int *buffer, int capacity) {
+    int count = 0;
+    while (count < capacity && rbIteratorNext(iterator, &(buffer[count]))) {
+        count++;
+    }
+    return count;
+}
+
+/*Place the finger on the root of the tree*/
+void rbFingerInit(RBTree *rbTree, RBFinger *finger) {
+    finger->tree = rbTree;
+    finger->node = rbTree->root;
+    finger->next = NULL;
+    return;
+}
+
+/*Subroutine for rbFingerSearch and rbFingerInsert. Climb from the finger through the parent pointers to the lowest node
+whose subtree holds the position of key, which is where a search from the root would pass as well, and return it. The
+climb towards larger keys stops at the first node that is a left child of a parent greater than key, and the climb
+towards smaller keys at the first right child of a parent less than key. bound is set to the smallest item above
+the returned subtree: that parent when climbing towards larger keys, nil when the climb reaches the root, and NULL when
+it is not known. Pass NULL for bound if it is not needed*/
+RBTNode *rbFingerClimb(RBFinger *finger, int key, RBTNode **bound) {
+    RBTNode *nil = finger->tree->nil, *node = finger->node, *parent, *above = nil;
+    if (node == nil) {
+        node = finger->tree->root;
+    } else if (key >= node->item) {
+        for (parent = node->parent; parent != nil; node = parent, parent = parent->parent) {
+            if (node == parent->left && key < parent->item) {
+                above = parent;
+                break;
+            }
+        }
+    } else {
+        for (parent = node->parent; parent != nil; node = parent, parent = parent->parent) {
+            if (node == parent->right && key > parent->item) {
+                above = NULL;
+                break;
+            }
+        }
+    }
+    if (bound != NULL) {
+        *bound = above;
+    }
+    return node;
+}
+
+/*Search for key starting from the finger and move the finger to the node found. Returns that node, or nil if key is
+absent, in which case the finger stays where it was. A search for the finger's own item or for the next one costs
+O(1), and a search d items away climbs and descends O(log d) levels when the two nodes sit low in the tree*/
+RBTNode *rbFingerSearch(RBFinger *finger, int key) {
+    RBTree *rbTree = finger->tree;
+    RBTNode *node = finger->node;
+    if (node != rbTree->nil && key == node->item) {
+        return node;
+    }
+    if (node != rbTree->nil && finger->next != NULL && finger->next != rbTree->nil && key == finger->next->item) {
+        node = finger->next;
+    } else {
+        node = rbIterativeTreeSearch(rbTree, rbFingerClimb(finger, key, NULL), key);
+        if (node == rbTree->nil) {
+            return node;
+        }
+    }
+    finger->node = node;
+    finger->next = NULL;
+    return node;
+}
+
+/*Insert key starting from the finger, move the finger to the node holding it and return that node. A key that falls
+between the finger's node and its successor is linked in O(1) time, so inserting an ascending run costs O(1) amortized
+per key besides the fixup. Other keys climb from the finger with rbFingerClimb and descend from there. In a multiset
+a key that is already present has its count incremented. Builds with order statistics or intervals still update every
+ancestor of the new node up to the root, which makes each insert O(log n) there*/
+RBTNode *rbFingerInsert(RBFinger *finger, int key) {
+    RBTree *rbTree = finger->tree;
+    RBTNode *nil = rbTree->nil, *node = finger->node, *next, *cur, *parent, *newNode;
+#if RB_STATS
+    int depth = 0;
+#endif
+    if (node != nil && finger->next == NULL) {
+        finger->next = rbTreeSuccessor(rbTree, node);
+    }
+    next = finger->next;
+    if (rbTree->multiset && node != nil && key == node->item) {
+        rbAddCopies(rbTree, node, 1);
+        return node;
+    }
+    if (node != nil && node->item <= key && (next == nil || key < next->item)) {
+        //key goes right after node: into node's right child if it has none, and otherwise into the left child of next,
+        //which is then the minimum of node's right subtree
+        parent = node->right == nil ? node : next;
+    } else {
+        parent = nil;
+        for (cur = rbFingerClimb(finger, key, &next); cur != nil; ) {
+            if (rbTree->multiset && key == cur->item) {
+                rbAddCopies(rbTree, cur, 1);
+                finger->node = cur;
+                finger->next = NULL;
+                return cur;
+            }
+            parent = cur;
+#if RB_STATS
+            depth++;
+#endif
+            if (key < cur->item) {
+                next = cur;
+                cur = cur->left;
+            } else {
+                cur = cur->right;
+            }
+        }
+    }
+    newNode = rbNodeAlloc(rbTree, key);
+    newNode->parent = parent;
+    if (parent == nil) {
+        rbTree->root = newNode;
+    } else if (key < parent->item) {
+        parent->left = newNode;
+    } else {
+        parent->right = newNode;
+    }
+#if RB_ORDER_STATISTICS || RB_INTERVALS
+    for (cur = parent; cur != nil; cur = cur->parent) {
+#if RB_ORDER_STATISTICS
+        cur->size++;
+#endif
+#if RB_INTERVALS
+        cur->max = RB_MAX(cur->max, newNode->high);
+#endif
+    }
+#endif
+    newNode->color = 1;
+    RB_STAT(inserts);
+    RB_STAT_BUCKET(insertDepth, depth, RB_STATS_DEPTHS);
+    rbInsertFixUp(rbTree, newNode);
+    finger->node = newNode;
+    finger->next = next;
+    return newNode;
+}
+
+/*Insert the n keys of a sorted, or mostly sorted, array with a finger that follows the inserted keys. Each key lands
+right after the previous one, so rather than a descent from the root it costs a climb as high as the keys in between
+reach. Unsorted input is inserted correctly, only without the gain*/
+void rbInsertSortedBatch(RBTree *rbTree, const int *keys, int n) {
+    RBFinger finger;
+    int i;
+    rbFingerInit(rbTree, &finger);
+    for (i = 0; i < n; i++) {
+        rbFingerInsert(&finger, keys[i]);
+    }
+    return;
+}
+
+/*Create an empty buffered tree whose write buffer is merged into the tree every capacity operations*/
+RBBufferedTree *rbBufferedCreate(int capacity) {
+    RBBufferedTree *buffered;
+    int slots = 2;
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    //Keep the index at most half full
+    while (slots < 2 * capacity) {
+        slots *= 2;
+    }
+    buffered = malloc(sizeof(RBBufferedTree));
+    buffered->tree = rbTreeCreate();
+    buffered->ops = malloc(capacity * sizeof(RBWriteOp));
+    buffered->index = malloc(slots * sizeof(int));
+    memset(buffered->index, -1, slots * sizeof(int));
+    buffered->count = 0;
+    buffered->capacity = capacity;
+    buffered->mask = slots - 1;
+    buffered->size = 0;
+    buffered->merges = buffered->lookups = buffered->probes = buffered->treeSearches = 0;
+    return buffered;
+}
+
+/*Release a buffered tree along with its tree. Buffered operations are dropped*/
+void rbBufferedDestroy(RBBufferedTree *buffered) {
+    rbTreeDestroy(buffered->tree);
+    free(buffered->ops);
+    free(buffered->index);
+    free(buffered);
+    return;
+}
+
+/*Add key to the set. Costs an append to the buffer, plus a merge every capacity operations*/
+void rbBufferedInsert(RBBufferedTree *buffered, int key) {
+    rbBufferedAppend(buffered, key, 1);
+    return;
+}
+
+/*Remove key from the set by appending a tombstone, which cancels the key in the tree at the next merge*/
+void rbBufferedDelete(RBBufferedTree *buffered, int key) {
+    rbBufferedAppend(buffered, key, 0);
+    return;
+}
+
+/*Subroutine for rbBufferedInsert and rbBufferedDelete. Append the operation, point the index entry of key at it, and
+merge the buffer once it is full*/
+void rbBufferedAppend(RBBufferedTree *buffered, int key, int insert) {
+    uint32_t slot = ((uint32_t)key * 2654435761u) & buffered->mask;
+    while (buffered->index[slot] >= 0 && buffered->ops[buffered->index[slot]].key != key) {
+        slot = (slot + 1) & buffered->mask;
+    }
+    buffered->index[slot] = buffered->count;
+    buffered->ops[buffered->count].key = key;
+    buffered->ops[buffered->count].insert = insert;
+    if (++(buffered->count) == buffered->capacity) {
+        rbBufferedMerge(buffered);
+    }
+    return;
+}
+
+/*Return 1 if key is in the set. The latest buffered operation on key decides if there is one, otherwise the tree is
+searched*/
+int rbBufferedSearch(RBBufferedTree *buffered, int key) {
+    uint32_t slot = ((uint32_t)key * 2654435761u) & buffered->mask;
+    buffered->lookups++;
+    for (buffered->probes++; buffered->index[slot] >= 0; buffered->probes++) {
+        if (buffered->ops[buffered->index[slot]].key == key) {
+            return buffered->ops[buffered->index[slot]].insert;
+        }
+        slot = (slot + 1) & buffered->mask;
+    }
+    buffered->treeSearches++;
+    return rbIterativeTreeSearch(buffered->tree, buffered->tree->root, key) != buffered->tree->nil;
+}
+
+/*Apply the buffer to the tree and empty it. Only the latest operation on each key counts, and those are gathered
+through the index and sorted. A buffer that is large next to the tree is merged with the in-order sequence of the
+tree into one sorted array, from which the tree is rebuilt in O(n) with no fixups or rotations at all. A small buffer
+is instead applied one key at a time, in order, so that consecutive searches share most of their path and find it in
+cache. A finger is no help there: its keys are too far apart for the climb to pay off*/
+void rbBufferedMerge(RBBufferedTree *buffered) {
+    RBTree *rbTree = buffered->tree;
+    RBWriteOp *latest;
+    RBIterator iterator;
+    RBTNode *node;
+    int *merged;
+    int i, m = 0, n = 0, key, more;
+    if (buffered->count == 0) {
+        return;
+    }
+    latest = malloc(buffered->count * sizeof(RBWriteOp));
+    for (i = 0; i <= buffered->mask; i++) {
+        if (buffered->index[i] >= 0) {
+            latest[m++] = buffered->ops[buffered->index[i]];
+            buffered->index[i] = -1;
+        }
+    }
+    qsort(latest, m, sizeof(RBWriteOp), rbCompareWriteOps);
+    if ((long)m * RB_BUFFER_REBUILD >= buffered->size) {
+        merged = malloc((buffered->size + m) * sizeof(int));
+        rbIteratorInit(rbTree, &iterator);
+        more = rbIteratorNext(&iterator, &key);
+        for (i = 0; i < m || more; ) {
+            if (i == m || (more && key < latest[i].key)) {
+                merged[n++] = key;
+                more = rbIteratorNext(&iterator, &key);
+                continue;
+            }
+            if (more && key == latest[i].key) {
+                more = rbIteratorNext(&iterator, &key); //The buffered operation replaces the key in the tree
+            }
+            if (latest[i].insert) {
+                merged[n++] = latest[i].key;
+            }
+            i++;
+        }
+        rbTreeBuildSorted(rbTree, merged, n, 0);
+        free(merged);
+    } else {
+        for (i = 0, n = buffered->size; i < m; i++) {
+            node = rbIterativeTreeSearch(rbTree, rbTree->root, latest[i].key);
+            if (latest[i].insert && node == rbTree->nil) {
+                rbTreeInsert(rbTree, rbNodeAlloc(rbTree, latest[i].key));
+                n++;
+            } else if (!latest[i].insert && node != rbTree->nil) {
+                treeDelete(rbTree, node);
+                rbNodeFree(rbTree, node);
+                n--;
+            }
+        }
+    }
+    buffered->size = n;
+    buffered->count = 0;
+    buffered->merges++;
+    free(latest);
+    return;
+}
+
+/*Subroutine for rbBufferedMerge*/
+int rbCompareWriteOps(const void *a, const void *b) {
+    int x = ((const RBWriteOp *)a)->key, y = ((const RBWriteOp *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+/*Create an empty red-black tree with its own node pool. The sentinel is the first node handed out by the pool*/
+RBTree *rbTreeCreate(void) {
+    RBTree *rbTree;
+    rbTree = malloc(sizeof(RBTree));
+    rbTree->pool = malloc(sizeof(RBTNodePool));
+    rbTree->pool->slabs = NULL;
+    rbTree->pool->freeList = NULL;
+    rbTree->pool->used = 0;
+    rbTree->pool->refs = 1;
+    rbTree->nil = NULL;
+    rbTree->nil = rbNodeAlloc(rbTree, 0);
+    rbTree->nil->color = 0; //Set SentinelNode Color to Black
+#if RB_ORDER_STATISTICS
+    rbTree->nil->size = 0;
+#endif
+#if RB_INTERVALS
+    rbTree->nil->high = INT_MIN;
+    rbTree->nil->max = INT_MIN;
+#endif
+    rbTree->nil->left = rbTree->nil;
+    rbTree->nil->right = rbTree->nil;
+    rbTree->nil->parent = rbTree->nil;
+    rbTree->root = rbTree->nil;
+    rbTree->multiset = 0;
+    rbTree->cache = NULL;
+    return rbTree;
+}
+
+/*Create an empty red-black tree that draws its nodes from the same pool, and uses the same sentinel, as rbTree. Only
+trees that share a pool can exchange nodes, as rbJoin and rbSplit do*/
+RBTree *rbTreeCreateShared(RBTree *rbTree) {
+    RBTree *shared;
+    shared = malloc(sizeof(RBTree));
+    shared->pool = rbTree->pool;
+    shared->nil = rbTree->nil;
+    shared->root = shared->nil;
+    shared->multiset = rbTree->multiset;
+    shared->cache = NULL;
+    shared->pool->refs++;
+    return shared;
+}
+
+/*Release a red-black tree along with every node it holds. If it is the last tree using its pool, all nodes live in the
+pool's slabs and this costs one free per slab rather than one free per node. Otherwise its nodes are handed back to
+the pool for the trees that remain*/
+void rbTreeDestroy(RBTree *rbTree) {
+    RBTNodeSlab *slab, *next;
+    rbCacheEnable(rbTree, 0);
+    if (--rbTree->pool->refs > 0) {
+        treeDeleteAll(rbTree, &(rbTree->root));
+        free(rbTree);
+        return;
+    }
+    for (slab = rbTree->pool->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    free(rbTree->pool);
+    free(rbTree);
+    return;
+}
+
+/*Hand out a red node holding item, reusing a recycled node if there is one and otherwise taking the next unused
+node of the head slab. A new slab, twice as large as the previous one, is added when the head slab is full*/
+RBTNode *rbNodeAlloc(RBTree *rbTree, int item) {
+    RBTNodePool *pool = rbTree->pool;
+    RBTNodeSlab *slab;
+    RBTNode *node;
+    int capacity;
+#if RB_STATS
+    double start;
+#endif
+    if (pool->freeList != NULL) {
+        node = pool->freeList;
+        pool->freeList = node->right;
+    } else {
+        if (pool->slabs == NULL || pool->used == pool->slabs->capacity) {
+            capacity = pool->slabs == NULL ? RB_SLAB_MIN : pool->slabs->capacity * 2;
+            if (capacity > RB_SLAB_MAX) {
+                capacity = RB_SLAB_MAX;
+            }
+#if RB_STATS
+            start = rbNow();
+#endif
+            slab = malloc(sizeof(RBTNodeSlab) + capacity * sizeof(RBTNode));
+#if RB_STATS
+            RB_STAT(slabAllocations);
+            RB_STAT_ADD(slabSeconds, rbNow() - start);
+#endif
+            slab->next = pool->slabs;
+            slab->capacity = capacity;
+            pool->slabs = slab;
+            pool->used = 0;
+        }
+        node = &(pool->slabs->nodes[pool->used++]);
+    }
+    node->item = item;
+    node->count = 1;
+    node->color = 1;
+    node->left = rbTree->nil;
+    node->right = rbTree->nil;
+    node->parent = rbTree->nil;
+#if RB_ORDER_STATISTICS
+    node->size = 1;
+#endif
+#if RB_INTERVALS
+    node->high = item;
+    node->max = item;
+#endif
+    return node;
+}
+
+/*Return a node that is no longer linked into the tree to the pool so that the next rbNodeAlloc can reuse it*/
+void rbNodeFree(RBTree *rbTree, RBTNode *node) {
+    node->right = rbTree->pool->freeList;
+    rbTree->pool->freeList = node;
+    return;
+}
+
+/*Given a sorted array of n keys, replace the contents of the tree with a red-black tree holding those keys in O(n)
+time. If unique is nonzero, repeated keys are only stored once. Otherwise, in a multiset, each run of a repeated key
+becomes one node whose count is the length of the run*/
+void rbTreeBuildSorted(RBTree *rbTree, const int *keys, int n, int unique) {
+    int *distinct = NULL, *counts = NULL;
+    int i, m, redDepth;
+    rbCacheClear(rbTree);
+    treeDeleteAll(rbTree, &(rbTree->root));
+    if ((unique || rbTree->multiset) && n > 0) {
+        //Compact the keys into a scratch copy so that every key is only stored once, counting the copies of each key
+        //when the tree is a multiset that keeps them
+        distinct = malloc(n * sizeof(int));
+        if (!unique) {
+            counts = malloc(n * sizeof(int));
+            counts[0] = 1;
+        }
+        distinct[0] = keys[0];
+        for (i = 1, m = 1; i < n; i++) {
+            if (keys[i] != distinct[m - 1]) {
+                if (counts != NULL) {
+                    counts[m] = 1;
+                }
+                distinct[m++] = keys[i];
+            } else if (counts != NULL) {
+                counts[m - 1]++;
+            }
+        }
+        keys = distinct;
+        n = m;
+    }
+    //Splitting at the middle fills every level except possibly the deepest one, which sits at depth floor(log2(n)).
+    //Colouring that level red and everything else black gives every root-to-leaf path the same number of black nodes.
+    //If the deepest level is full then the tree is perfect and can be coloured entirely black.
+    redDepth = -1;
+    if ((n & (n + 1)) != 0) {
+        for (redDepth = 0, m = n; m > 1; m >>= 1) {
+            redDepth++;
+        }
+    }
+    rbTree->root = rbBuildSubtree(rbTree, keys, counts, 0, n - 1, 0, redDepth);
+    rbTree->root->parent = rbTree->nil;
+    if (rbTree->root != rbTree->nil) {
+        rbTree->root->color = 0;
+    }
+    free(distinct);
+    free(counts);
+    return;
+}
+
+/*Subroutine for rbTreeBuildSorted, which builds the subtree holding keys[lo..hi] with its root at the given depth and
+returns a pointer to that root. counts[i] is the number of copies of keys[i], or every key has one if counts is NULL*/
+RBTNode *rbBuildSubtree(RBTree *rbTree, const int *keys, const int *counts, int lo, int hi, int depth,
+    int redDepth) {
+    RBTNode *node;
+    int mid;
+    if (lo > hi) {
+        return rbTree->nil;
+    }
+    mid = lo + (hi - lo) / 2;
+    node = rbNodeAlloc(rbTree, keys[mid]);
+    node->count = counts != NULL ? counts[mid] : 1;
+    node->color = depth == redDepth ? 1 : 0;
+    node->left = rbBuildSubtree(rbTree, keys, counts, lo, mid - 1, depth + 1, redDepth);
+    node->right = rbBuildSubtree(rbTree, keys, counts, mid + 1, hi, depth + 1, redDepth);
+    RB_UPDATE_SIZE(node);
+    RB_UPDATE_MAX(node);
+    if (node->left != rbTree->nil) {
+        node->left->parent = node;
+    }
+    if (node->right != rbTree->nil) {
+        node->right->parent = node;
+    }
+    return node;
+}
+
+/*Return the black-height of the tree: the number of black nodes on every path from the root down to a leaf*/
+int rbBlackHeight(RBTree *rbTree) {
+    RBTNode *node;
+    int height = 0;
+    for (node = rbTree->root; node != rbTree->nil; node = node->left) {
+        height += node->color == 0;
+    }
+    return height;
+}
+
+/*Join rbTree, a node holding key and other into one red-black tree held by rbTree, leaving other empty. Every item of
+rbTree must be no greater than key and every item of other no less than key, and both trees must share a pool (see
+rbTreeCreateShared). Takes O(log n) time. Returns 0, changing nothing, if either requirement is not met. In a multiset,
+key becomes one more copy of a node that already holds it, and if both trees hold key their copies are merged into a
+single node*/
+int rbJoin(RBTree *rbTree, int key, RBTree *other) {
+    RBTNode *nil = rbTree->nil, *low, *high;
+    int height;
+    low = rbTree->root == nil ? nil : rbTreeMax(rbTree, rbTree->root);
+    high = other->root == nil ? nil : rbTreeMin(other, other->root);
+    if (rbTree->pool != other->pool || (low != nil && low->item > key) || (high != nil && high->item < key)) {
+        return 0;
+    }
+    if (rbTree->multiset && ((low != nil && low->item == key) || (high != nil && high->item == key))) {
+        if (high != nil && high->item == key) {
+            if (low != nil && low->item == key) {
+                rbAddCopies(rbTree, low, high->count);
+                treeDelete(other, high);
+                rbNodeFree(other, high);
+            } else {
+                low = high;
+            }
+        }
+        rbAddCopies(rbTree, low, 1);
+        rbTree->root = rbJoinPair(rbTree, rbTree->root, rbBlackHeight(rbTree), other->root, rbBlackHeight(other),
+            &height);
+        other->root = other->nil;
+        rbCacheClear(other);
+        return 1;
+    }
+    rbTree->root = rbJoinSubtrees(rbTree, rbTree->root, rbBlackHeight(rbTree), rbNodeAlloc(rbTree, key), other->root,
+        rbBlackHeight(other), &height);
+    other->root = other->nil;
+    rbCacheClear(other);
+    return 1;
+}
+
+/*Split rbTree at key in O(log n) time: rbTree keeps the items less than key, and the items not less than key are moved
+into a new tree sharing rbTree's pool, which is returned*/
+RBTree *rbSplit(RBTree *rbTree, int key) {
+    RBTree *notLess;
+    RBTNode *root = rbTree->root;
+    int height, lessHeight, notLessHeight;
+    notLess = rbTreeCreateShared(rbTree);
+    height = rbBlackHeight(rbTree);
+    rbCacheClear(rbTree);
+    rbSplitSubtree(rbTree, root, height, key, &(rbTree->root), &lessHeight, &(notLess->root), &notLessHeight, NULL);
+    return notLess;
+}
+
+/*Subroutine for rbJoin and rbSplit, the join of CLRS problem 13-2. left and right are detached red-black subtrees with
+black roots and the given black-heights, whose items are no greater and no less than middle's item respectively.
+middle is a node that is not in any tree. Returns the root of the joined subtree and stores its black-height in height.
+The shorter subtree is hung, with middle as its parent, in place of the black node of equal black-height on the facing
+spine of the taller one. middle is red, so only property 4 can break, and rbInsertFixUp repairs it with the usual
+rotations. Costs O(|leftHeight - rightHeight| + 1)*/
+RBTNode *rbJoinSubtrees(RBTree *rbTree, RBTNode *left, int leftHeight, RBTNode *middle, RBTNode *right, int rightHeight,
+    int *height) {
+    RBTree work = *rbTree; //Rotations and the fixup update work.root instead of the caller's tree
+    RBTNode *nil = rbTree->nil, *parent = nil, *cur;
+    int h;
+    if (leftHeight >= rightHeight) {
+        //Walk down the right spine of left to the first black node whose black-height equals that of right
+        work.root = left;
+        for (cur = left, h = leftHeight; cur != nil && (h > rightHeight || cur->color == 1); cur = cur->right) {
+            h -= cur->color == 0;
+#if RB_ORDER_STATISTICS
+            cur->size += right->size + middle->count; //Everything joined will end up below cur
+#endif
+#if RB_INTERVALS
+            cur->max = RB_MAX(cur->max, RB_MAX(right->max, middle->high));
+#endif
+            parent = cur;
+        }
+        middle->left = cur;
+        middle->right = right;
+        if (parent == nil) {
+            work.root = middle;
+        } else {
+            parent->right = middle;
+        }
+    } else {
+        //Mirror image: walk down the left spine of right
+        work.root = right;
+        for (cur = right, h = rightHeight; cur != nil && (h > leftHeight || cur->color == 1); cur = cur->left) {
+            h -= cur->color == 0;
+#if RB_ORDER_STATISTICS
+            cur->size += left->size + middle->count;
+#endif
+#if RB_INTERVALS
+            cur->max = RB_MAX(cur->max, RB_MAX(left->max, middle->high));
+#endif
+            parent = cur;
+        }
+        middle->left = left;
+        middle->right = cur;
+        if (parent == nil) {
+            work.root = middle;
+        } else {
+            parent->left = middle;
+        }
+    }
+    middle->parent = parent;
+    if (middle->left != nil) {
+        middle->left->parent = middle;
+    }
+    if (middle->right != nil) {
+        middle->right->parent = middle;
+    }
+    middle->color = 1;
+    RB_UPDATE_SIZE(middle);
+    RB_UPDATE_MAX(middle);
+    *height = (leftHeight > rightHeight ? leftHeight : rightHeight) + rbInsertFixUp(&work, middle);
+    return work.root;
+}
+
+/*Subroutine for rbSplit. Splits the subtree rooted at node, whose black-height is height, into the subtree of items
+less than key and the subtree of items not less than key, returning each root with its black-height. Every node on the
+search path for key is cut loose from its children, which become independent subtrees with black roots, and is then
+reused as the middle node of a join on the side it belongs to. The black-heights of the joined subtrees telescope, so
+the whole split takes O(log n). If match is not NULL, a node holding key is taken out of the split instead and stored
+in match, or nil is stored if there is none, so the second subtree holds the items greater than key*/
+void rbSplitSubtree(RBTree *rbTree, RBTNode *node, int height, int key, RBTNode **less, int *lessHeight,
+    RBTNode **notLess, int *notLessHeight, RBTNode **match) {
+    RBTNode *nil = rbTree->nil, *left, *right, *part;
+    int leftHeight, rightHeight, partHeight;
+    if (node == nil) {
+        *less = *notLess = nil;
+        *lessHeight = *notLessHeight = 0;
+        if (match != NULL) {
+            *match = nil;
+        }
+        return;
+    }
+    left = node->left;
+    right = node->right;
+    rbDetachChildren(rbTree, node, height, &leftHeight, &rightHeight);
+    if (match != NULL && key == node->item) {
+        *match = node;
+        *less = left;
+        *lessHeight = leftHeight;
+        *notLess = right;
+        *notLessHeight = rightHeight;
+    } else if (key <= node->item) {
+        //node and its right subtree belong to the upper part, the left subtree has to be split further
+        rbSplitSubtree(rbTree, left, leftHeight, key, less, lessHeight, &part, &partHeight, match);
+        *notLess = rbJoinSubtrees(rbTree, part, partHeight, node, right, rightHeight, notLessHeight);
+    } else {
+        rbSplitSubtree(rbTree, right, rightHeight, key, &part, &partHeight, notLess, notLessHeight, match);
+        *less = rbJoinSubtrees(rbTree, left, leftHeight, node, part, partHeight, lessHeight);
+    }
+    return;
+}
+
+/*Split the largest node off the nonempty subtree rooted at node, whose black-height is height. The largest node is
+stored in last and the subtree left behind in rest, with its black-height in restHeight. Takes O(log n)*/
+void rbSplitLast(RBTree *rbTree, RBTNode *node, int height, RBTNode **rest, int *restHeight, RBTNode **last) {
+    RBTNode *left = node->left, *right = node->right, *part;
+    int leftHeight, rightHeight, partHeight;
+    rbDetachChildren(rbTree, node, height, &leftHeight, &rightHeight);
+    if (right == rbTree->nil) {
+        *last = node;
+        *rest = left;
+        *restHeight = leftHeight;
+        return;
+    }
+    rbSplitLast(rbTree, right, rightHeight, &part, &partHeight, last);
+    *rest = rbJoinSubtrees(rbTree, left, leftHeight, node, part, partHeight, restHeight);
+    return;
+}
+
+/*Cut both children of node, whose black-height is height, loose as independent subtrees and return their black-heights.
+A red child becomes a black root, which adds one to its black-height*/
+void rbDetachChildren(RBTree *rbTree, RBTNode *node, int height, int *leftHeight, int *rightHeight) {
+    *leftHeight = *rightHeight = height - (node->color == 0);
+    if (node->left != rbTree->nil) {
+        node->left->parent = rbTree->nil;
+        *leftHeight += node->left->color;
+        node->left->color = 0;
+    }
+    if (node->right != rbTree->nil) {
+        node->right->parent = rbTree->nil;
+        *rightHeight += node->right->color;
+        node->right->color = 0;
+    }
+    return;
+}
+
+/*Join two detached subtrees without a middle item, every item of left being no greater than every item of right. The
+largest node of left is split off and used as the middle of rbJoinSubtrees*/
+RBTNode *rbJoinPair(RBTree *rbTree, RBTNode *left, int leftHeight, RBTNode *right, int rightHeight, int *height) {
+    RBTNode *last;
+    if (left == rbTree->nil) {
+        *height = rightHeight;
+        return right;
+    }
+    rbSplitLast(rbTree, left, leftHeight, &left, &leftHeight, &last);
+    return rbJoinSubtrees(rbTree, left, leftHeight, last, right, rightHeight, height);
+}
+
+/*Start a pool of count workers for the set operations. The calling thread is one of them, so count - 1 threads are
+started. They sleep while no operation is running*/
+RBThreadPool *rbThreadPoolCreate(int count) {
+    RBThreadPool *threads;
+    int i;
+    if (count < 1) {
+        count = 1;
+    }
+    threads = malloc(sizeof(RBThreadPool));
+    threads->count = count;
+    threads->workers = calloc(count, sizeof(RBWorker));
+    threads->ids = malloc(count * sizeof(pthread_t));
+    pthread_mutex_init(&(threads->lock), NULL);
+    pthread_cond_init(&(threads->wake), NULL);
+    atomic_init(&(threads->active), 0);
+    atomic_init(&(threads->stop), 0);
+    for (i = 0; i < count; i++) {
+        threads->workers[i].threads = threads;
+        pthread_mutex_init(&(threads->workers[i].lock), NULL);
+        threads->workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    for (i = 1; i < count; i++) {
+        pthread_create(&(threads->ids[i]), NULL, rbWorkerMain, &(threads->workers[i]));
+    }
+    return threads;
+}
+
+/*Stop and join the pool's threads and release it*/
+void rbThreadPoolDestroy(RBThreadPool *threads) {
+    int i;
+    pthread_mutex_lock(&(threads->lock));
+    atomic_store(&(threads->stop), 1);
+    pthread_cond_broadcast(&(threads->wake));
+    pthread_mutex_unlock(&(threads->lock));
+    for (i = 1; i < threads->count; i++) {
+        pthread_join(threads->ids[i], NULL);
+    }
+    for (i = 0; i < threads->count; i++) {
+        pthread_mutex_destroy(&(threads->workers[i].lock));
+    }
+    pthread_mutex_destroy(&(threads->lock));
+    pthread_cond_destroy(&(threads->wake));
+    free(threads->workers);
+    free(threads->ids);
+    free(threads);
+    return;
+}
+
+/*Body of every worker thread but the caller's: sleep until an operation starts, then keep stealing tasks until it ends*/
+void *rbWorkerMain(void *arg) {
+    RBWorker *worker = arg;
+    RBThreadPool *threads = worker->threads;
+    RBSetTask *task;
+    for (;;) {
+        pthread_mutex_lock(&(threads->lock));
+        while (!atomic_load(&(threads->active)) && !atomic_load(&(threads->stop))) {
+            pthread_cond_wait(&(threads->wake), &(threads->lock));
+        }
+        pthread_mutex_unlock(&(threads->lock));
+        if (atomic_load(&(threads->stop))) {
+            return NULL;
+        }
+        if ((task = rbWorkerSteal(worker)) != NULL) {
+            rbSetRun(worker, task);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/*Push task on the tail of the worker's deque. Returns 0 if the deque is full*/
+int rbWorkerPush(RBWorker *worker, RBSetTask *task) {
+    int pushed = 0;
+    pthread_mutex_lock(&(worker->lock));
+    if (worker->tail < RB_DEQUE_SIZE) {
+        worker->deque[worker->tail++] = task;
+        pushed = 1;
+    }
+    pthread_mutex_unlock(&(worker->lock));
+    return pushed;
+}
+
+/*Take task back off the tail of the worker's deque. Returns 0 if a thief got to it first*/
+int rbWorkerPop(RBWorker *worker, RBSetTask *task) {
+    int popped = 0;
+    pthread_mutex_lock(&(worker->lock));
+    if (worker->tail > worker->head && worker->deque[worker->tail - 1] == task) {
+        worker->tail--;
+        popped = 1;
+    }
+    if (worker->head == worker->tail) {
+        worker->head = worker->tail = 0;
+    }
+    pthread_mutex_unlock(&(worker->lock));
+    return popped;
+}
+
+/*Take the task at the head of a randomly chosen worker's deque, or return NULL if that deque is empty*/
+RBSetTask *rbWorkerSteal(RBWorker *worker) {
+    RBThreadPool *threads = worker->threads;
+    RBWorker *victim;
+    RBSetTask *task = NULL;
+    victim = &(threads->workers[rbRandom(&(worker->seed)) % (uint64_t)threads->count]);
+    if (victim == worker) {
+        return NULL;
+    }
+    pthread_mutex_lock(&(victim->lock));
+    if (victim->head < victim->tail) {
+        task = victim->deque[victim->head++];
+    }
+    pthread_mutex_unlock(&(victim->lock));
+    return task;
+}
+
+/*Replace rbTree with the union of the items of rbTree and other, leaving other empty. Both trees must share a pool
+(see rbTreeCreateShared) and are treated as sets, so an item held by both is kept once. If rbTree is a multiset the
+copies of an item held by both are added up instead, intersection keeps the smaller of the two counts and difference
+subtracts the copies in other. The operation splits rbTree on the root item of other and unions the two sides
+independently, in parallel on threads if it is not NULL, before joining them again. Returns 0, changing nothing, if
+the trees do not share a pool*/
+int rbTreeUnion(RBTree *rbTree, RBTree *other, RBThreadPool *threads) {
+    return rbSetOperation(rbTree, other, 'u', threads);
+}
+
+/*Like rbTreeUnion, but keep only the items held by both trees*/
+int rbTreeIntersection(RBTree *rbTree, RBTree *other, RBThreadPool *threads) {
+    return rbSetOperation(rbTree, other, 'i', threads);
+}
+
+/*Like rbTreeUnion, but keep only the items of rbTree that other does not hold*/
+int rbTreeDifference(RBTree *rbTree, RBTree *other, RBThreadPool *threads) {
+    return rbSetOperation(rbTree, other, 'd', threads);
+}
+
+/*Subroutine for the set operations. Runs the top task on the calling thread, with the pool's workers stealing from it
+while it runs, then hands every node the operation dropped back to the pool. A thread pool serves one operation at a
+time*/
+int rbSetOperation(RBTree *rbTree, RBTree *other, char op, RBThreadPool *threads) {
+    RBWorker single, *worker;
+    RBSetTask task;
+    RBTNode *node, *next;
+    int i, count = 1;
+    if (rbTree->pool != other->pool) {
+        return 0;
+    }
+    task.tree = rbTree;
+    task.op = op;
+    task.a = rbTree->root;
+    task.aHeight = rbBlackHeight(rbTree);
+    task.b = other->root;
+    task.bHeight = rbBlackHeight(other);
+    atomic_init(&(task.done), 0);
+    if (threads == NULL) {
+        memset(&single, 0, sizeof(RBWorker));
+        single.garbage = rbTree->nil;
+        worker = &single;
+        rbSetRun(worker, &task);
+    } else {
+        count = threads->count;
+        worker = threads->workers;
+        for (i = 0; i < count; i++) {
+            worker[i].garbage = rbTree->nil;
+        }
+        pthread_mutex_lock(&(threads->lock));
+        atomic_store(&(threads->active), 1);
+        pthread_cond_broadcast(&(threads->wake));
+        pthread_mutex_unlock(&(threads->lock));
+        rbSetRun(worker, &task);
+        atomic_store(&(threads->active), 0);
+    }
+    rbTree->root = task.result;
+    other->root = other->nil;
+    rbCacheClear(rbTree);
+    rbCacheClear(other);
+    for (i = 0; i < count; i++) {
+        for (node = worker[i].garbage; node != rbTree->nil; node = next) {
+            next = node->parent;
+            treeDeleteAll(rbTree, &node);
+        }
+    }
+    return 1;
+}
+
+/*Combine the subtrees of task. The root of b is cut off, a is split on its item, and the two pairs of sides are combined
+recursively, the right pair as a forked task that another worker may steal. The results are then joined, with the
+root of b in the middle if the operation keeps its item. Subtrees that are too small to be worth a fork are combined
+on this worker*/
+void rbSetRecurse(RBWorker *worker, RBSetTask *task) {
+    RBTree *rbTree = task->tree;
+    RBTNode *nil = rbTree->nil, *middle = task->b, *match, *bLeft, *bRight, *spare;
+    RBSetTask left, right, *stolen;
+    int bLeftHeight, bRightHeight, keep;
+    if (task->a == nil || task->b == nil) {
+        //Union keeps whichever side is left, intersection keeps nothing and difference keeps what is left of a
+        if (task->op == 'u' || (task->op == 'd' && task->b == nil)) {
+            task->result = task->a == nil ? task->b : task->a;
+            task->resultHeight = task->a == nil ? task->bHeight : task->aHeight;
+        } else {
+            rbSetDiscard(rbTree, worker, task->a);
+            rbSetDiscard(rbTree, worker, task->b);
+            task->result = nil;
+            task->resultHeight = 0;
+        }
+        return;
+    }
+    bLeft = middle->left;
+    bRight = middle->right;
+    rbDetachChildren(rbTree, middle, task->bHeight, &bLeftHeight, &bRightHeight);
+    left = right = *task;
+    rbSplitSubtree(rbTree, task->a, task->aHeight, middle->item, &(left.a), &(left.aHeight), &(right.a),
+        &(right.aHeight), &match);
+    left.b = bLeft;
+    left.bHeight = bLeftHeight;
+    right.b = bRight;
+    right.bHeight = bRightHeight;
+    atomic_init(&(right.done), 0);
+    if (worker->threads != NULL && task->aHeight + task->bHeight >= RB_SET_GRAIN && rbWorkerPush(worker, &right)) {
+        rbSetRecurse(worker, &left);
+        if (rbWorkerPop(worker, &right)) {
+            rbSetRecurse(worker, &right);
+        } else {
+            //right was stolen. Help with other tasks until it is done
+            while (!atomic_load(&(right.done))) {
+                if ((stolen = rbWorkerSteal(worker)) != NULL) {
+                    rbSetRun(worker, stolen);
+                } else {
+                    sched_yield();
+                }
+            }
+        }
+    } else {
+        rbSetRecurse(worker, &left);
+        rbSetRecurse(worker, &right);
+    }
+    //Keep one node for the item if the operation keeps it: union always does, intersection only if a holds it too
+    keep = task->op == 'u' || (task->op == 'i' && match != nil);
+    if (rbTree->multiset && match != nil) {
+        //Copies add up in a union, the smaller count is common to both trees, and a difference keeps the copies of a
+        //that b does not cancel out, in a's node
+        if (task->op == 'u') {
+            middle->count += match->count;
+        } else if (task->op == 'i') {
+            middle->count = match->count < middle->count ? match->count : middle->count;
+        } else if (match->count > middle->count) {
+            match->count -= middle->count;
+            spare = middle;
+            middle = match;
+            match = spare;
+            keep = 1;
+        }
+    }
+    if (match != nil) {
+        match->left = match->right = nil;
+        rbSetDiscard(rbTree, worker, match);
+    }
+    if (keep) {
+        task->result = rbJoinSubtrees(rbTree, left.result, left.resultHeight, middle, right.result, right.resultHeight,
+            &(task->resultHeight));
+    } else {
+        middle->left = middle->right = nil;
+        rbSetDiscard(rbTree, worker, middle);
+        task->result = rbJoinPair(rbTree, left.result, left.resultHeight, right.result, right.resultHeight,
+            &(task->resultHeight));
+    }
+    return;
+}
+
+/*Combine the subtrees of task and publish the result to a worker that may be waiting for it*/
+void rbSetRun(RBWorker *worker, RBSetTask *task) {
+    rbSetRecurse(worker, task);
+    atomic_store(&(task->done), 1);
+    return;
+}
+
+/*Queue a detached subtree, which may be a single node, to be handed back to the pool once the operation is over. The
+pool's free list is not shared between threads, so nothing is freed while workers are running*/
+void rbSetDiscard(RBTree *rbTree, RBWorker *worker, RBTNode *node) {
+    if (node != rbTree->nil) {
+        node->parent = worker->garbage;
+        worker->garbage = node;
+    }
+    return;
+}
+
+/*Create an empty compact red-black tree with room for capacity nodes before its array has to grow*/
+RBCTree *rbcTreeCreate(uint32_t capacity) {
+    RBCTree *tree;
+    tree = malloc(sizeof(RBCTree));
+    tree->capacity = capacity < 16 ? 16 : capacity + 1;
+    tree->nodes = malloc(tree->capacity * sizeof(RBCNode));
+    //Slot 0 is the black sentinel, linked to itself just like rbTree->nil
+    tree->nodes[RBC_NIL].item = 0;
+    tree->nodes[RBC_NIL].left = RBC_NIL;
+    tree->nodes[RBC_NIL].right = RBC_NIL;
+    tree->nodes[RBC_NIL].parentColor = RBC_NIL;
+    tree->root = RBC_NIL;
+    tree->count = 1;
+    tree->mapping = NULL;
+    tree->mappingLength = 0;
+    return tree;
+}
+
+/*Release a compact red-black tree, which only takes freeing or unmapping its node array*/
+void rbcTreeDestroy(RBCTree *tree) {
+    if (tree->mapping != NULL) {
+        munmap(tree->mapping, tree->mappingLength);
+    } else {
+        free(tree->nodes);
+    }
+    free(tree);
+    return;
+}
+
+/*Append a red node holding item to the node array, doubling the array when it is full, and return its index. Since
+the array may move, pointers into it must not be held across this call; indices stay valid. A thawed image has no
+room to grow, so its nodes move to the heap the first time one is added*/
+uint32_t rbcNodeAlloc(RBCTree *tree, int item) {
+    RBCNode *nodes;
+    uint32_t node;
+    if (tree->count == tree->capacity) {
+        tree->capacity *= 2;
+        if (tree->mapping != NULL) {
+            nodes = malloc(tree->capacity * sizeof(RBCNode));
+            memcpy(nodes, tree->nodes, tree->count * sizeof(RBCNode));
+            munmap(tree->mapping, tree->mappingLength);
+            tree->mapping = NULL;
+            tree->nodes = nodes;
+        } else {
+            tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(RBCNode));
+        }
+    }
+    node = tree->count++;
+    tree->nodes[node].item = item;
+    tree->nodes[node].left = RBC_NIL;
+    tree->nodes[node].right = RBC_NIL;
+    tree->nodes[node].parentColor = RBC_NIL | RBC_RED;
+    return node;
+}
+
+/*Given a key, return the index of the node with item key if one exists, otherwise RBC_NIL*/
+uint32_t rbcIterativeTreeSearch(RBCTree *tree, int key) {
+    RBCNode *nodes = tree->nodes;
+    uint32_t node = tree->root;
+    while (node != RBC_NIL && key != nodes[node].item) {
+        if (key < nodes[node].item) {
+            node = nodes[node].left;
+        } else {
+            node = nodes[node].right;
+        }
+    }
+    return node;
+}
+
+/*leftRotate on the compact layout*/
+void rbcLeftRotate(RBCTree *tree, uint32_t node) {
+    RBCNode *nodes = tree->nodes;
+    uint32_t rNode, parent;
+    rNode = nodes[node].right;
+    nodes[node].right = nodes[rNode].left;
+    if (nodes[rNode].left != RBC_NIL) {
+        RBC_SET_PARENT(tree, nodes[rNode].left, node);
+    }
+    parent = RBC_PARENT(tree, node);
+    RBC_SET_PARENT(tree, rNode, parent);
+    if (parent == RBC_NIL) {
+        tree->root = rNode;
+    } else if (node == nodes[parent].left) {
+        nodes[parent].left = rNode;
+    } else {
+        nodes[parent].right = rNode;
+    }
+    nodes[rNode].left = node;
+    RBC_SET_PARENT(tree, node, rNode);
+    return;
+}
+
+/*rightRotate on the compact layout*/
+void rbcRightRotate(RBCTree *tree, uint32_t node) {
+    RBCNode *nodes = tree->nodes;
+    uint32_t lNode, parent;
+    lNode = nodes[node].left;
+    nodes[node].left = nodes[lNode].right;
+    if (nodes[lNode].right != RBC_NIL) {
+        RBC_SET_PARENT(tree, nodes[lNode].right, node);
+    }
+    parent = RBC_PARENT(tree, node);
+    RBC_SET_PARENT(tree, lNode, parent);
+    if (parent == RBC_NIL) {
+        tree->root = lNode;
+    } else if (node == nodes[parent].left) {
+        nodes[parent].left = lNode;
+    } else {
+        nodes[parent].right = lNode;
+    }
+    nodes[lNode].right = node;
+    RBC_SET_PARENT(tree, node, lNode);
+    return;
+}
+
+/*rbTreeInsert on the compact layout. The node is allocated here, since callers cannot hold on to node pointers*/
+void rbcTreeInsert(RBCTree *tree, int item) {
+    uint32_t parent = RBC_NIL, cur = tree->root, newNode;
+    //Allocate first, so that the array cannot move while we hold indices into it
+    newNode = rbcNodeAlloc(tree, item);
+    while (cur != RBC_NIL) {
+        parent = cur;
+        if (item < tree->nodes[cur].item) {
+            cur = tree->nodes[cur].left;
+        } else {
+            cur = tree->nodes[cur].right;
+        }
+    }
+    RBC_SET_PARENT(tree, newNode, parent);
+    if (parent == RBC_NIL) {
+        tree->root = newNode;
+    } else if (item < tree->nodes[parent].item) {
+        tree->nodes[parent].left = newNode;
+    } else {
+        tree->nodes[parent].right = newNode;
+    }
+    rbcInsertFixUp(tree, newNode);
+    return;
+}
+
+/*rbInsertFixUp on the compact layout, with the same cases and invariant*/
+void rbcInsertFixUp(RBCTree *tree, uint32_t node) {
+    RBCNode *nodes = tree->nodes;
+    uint32_t parent, grandparent, uncle;
+    while (RBC_IS_RED(tree, (parent = RBC_PARENT(tree, node)))) {
+        grandparent = RBC_PARENT(tree, parent);
+        if (parent == nodes[grandparent].left) {
+            uncle = nodes[grandparent].right;
+            if (RBC_IS_RED(tree, uncle)) { //Case 1: recolor and move two levels up
+                RBC_SET_BLACK(tree, parent);
+                RBC_SET_BLACK(tree, uncle);
+                RBC_SET_RED(tree, grandparent);
+                node = grandparent;
+            } else {
+                if (node == nodes[parent].right) { //Case 2: rotate to turn it into case 3
+                    node = parent;
+                    rbcLeftRotate(tree, node);
+                    parent = RBC_PARENT(tree, node);
+                }
+                RBC_SET_BLACK(tree, parent); //Case 3
+                RBC_SET_RED(tree, grandparent);
+                rbcRightRotate(tree, grandparent);
+            }
+        } else {
+            uncle = nodes[grandparent].left;
+            if (RBC_IS_RED(tree, uncle)) {
+                RBC_SET_BLACK(tree, parent);
+                RBC_SET_BLACK(tree, uncle);
+                RBC_SET_RED(tree, grandparent);
+                node = grandparent;
+            } else {
+                if (node == nodes[parent].left) {
+                    node = parent;
+                    rbcRightRotate(tree, node);
+                    parent = RBC_PARENT(tree, node);
+                }
+                RBC_SET_BLACK(tree, parent);
+                RBC_SET_RED(tree, grandparent);
+                rbcLeftRotate(tree, grandparent);
+            }
+        }
+    }
+    RBC_SET_BLACK(tree, tree->root);
+    return;
+}
+
+/*Write the tree to path as an image that rbImageOpen can map and search without parsing. Nodes are numbered in
+breadth-first order, which keeps the top levels of the tree together at the front of the file. Returns 1 on success
+and 0 if the file could not be written. An image holds bare keys: it has no room for copy counts or interval high
+ends, so a multiset, or a tree holding an interval [low, high] with high != low from rbIntervalInsert, is refused and
+nothing is written*/
+int rbTreeWriteImage(RBTree *rbTree, const char *path) {
+    RBImageHeader header;
+    RBTNode **queue;
+    RBCNode *nodes;
+    FILE *out;
+    uint32_t head, tail, count = 0;
+    int ok;
+    RBIterator iterator;
+    int key;
+
+    if (rbTree->multiset) {
+        return 0;
+    }
+    rbIteratorInit(rbTree, &iterator);
+    while (rbIteratorNext(&iterator, &key)) {
+        count++;
+    }
+    queue = malloc((count + 1) * sizeof(RBTNode *));
+    nodes = calloc(count + 1, sizeof(RBCNode));
+    //Node i of the image is queue[i]. Children are numbered as they are queued, so each link is known right away
+    tail = 1;
+    if (rbTree->root != rbTree->nil) {
+        queue[tail++] = rbTree->root;
+    }
+    for (head = 1; head < tail; head++) {
+#if RB_INTERVALS
+        if (queue[head]->high != queue[head]->item) {
+            free(queue);
+            free(nodes);
+            return 0;
+        }
+#endif
+        nodes[head].item = queue[head]->item;
+        if (queue[head]->color == 1) {
+            nodes[head].parentColor |= RBC_RED;
+        }
+        if (queue[head]->left != rbTree->nil) {
+            nodes[tail].parentColor = head;
+            nodes[head].left = tail;
+            queue[tail++] = queue[head]->left;
+        }
+        if (queue[head]->right != rbTree->nil) {
+            nodes[tail].parentColor = head;
+            nodes[head].right = tail;
+            queue[tail++] = queue[head]->right;
+        }
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RB_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = RB_IMAGE_VERSION;
+    header.nodeSize = sizeof(RBCNode);
+    header.count = count;
+    header.height = rbTreeHeight(rbTree);
+    header.root = count > 0 ? 1 : RBC_NIL;
+    header.checksum = rbImageChecksum(nodes, count + 1);
+    ok = (out = fopen(path, "wb")) != NULL;
+    ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(nodes, sizeof(RBCNode), count + 1, out) == count + 1;
+    if (out != NULL && fclose(out) != 0) {
+        ok = 0;
+    }
+    free(queue);
+    free(nodes);
+    return ok;
+}
+
+/*Map the image at path read-only and return a handle whose view can be searched in place. Opening costs a few system
+calls whatever the size of the tree, since pages are only read in as lookups touch them. If verify is nonzero the
+checksum and the links of every node are checked as well, which does read the whole file. Without verify only the
+header and the file size are checked and the file is trusted completely: a corrupt node array can send a lookup out
+of the mapping or around a cycle. Returns NULL, after saying why on stderr, if the file cannot be mapped or is not a
+valid image*/
+RBImage *rbImageOpen(const char *path, int verify) {
+    RBImage *image;
+    const RBImageHeader *header;
+    struct stat info;
+    void *mapping;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    if ((size_t)info.st_size < sizeof(RBImageHeader) + sizeof(RBCNode)) {
+        fprintf(stderr, "%s is not a tree image\n", path);
+        close(fd);
+        return NULL;
+    }
+    mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    header = mapping;
+    if (memcmp(header->magic, RB_IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != RB_IMAGE_VERSION ||
+        header->nodeSize != sizeof(RBCNode) ||
+        (size_t)info.st_size != sizeof(RBImageHeader) + ((size_t)header->count + 1) * sizeof(RBCNode) ||
+        header->root > header->count) {
+        fprintf(stderr, "%s is not a tree image of this version\n", path);
+        munmap(mapping, info.st_size);
+        close(fd);
+        return NULL;
+    }
+    if (verify && (rbImageChecksum((const RBCNode *)(header + 1), header->count + 1) != header->checksum ||
+        !rbImageCheckLinks((const RBCNode *)(header + 1), header->count))) {
+        fprintf(stderr, "%s is corrupt\n", path);
+        munmap(mapping, info.st_size);
+        close(fd);
+        return NULL;
+    }
+    image = malloc(sizeof(RBImage));
+    image->fd = fd;
+    image->mapping = mapping;
+    image->length = info.st_size;
+    image->header = header;
+    image->view.nodes = (RBCNode *)(header + 1);
+    image->view.root = header->root;
+    image->view.count = image->view.capacity = header->count + 1;
+    image->view.mapping = NULL; //The view does not own the mapping, the image does
+    image->view.mappingLength = 0;
+    return image;
+}
+
+/*Unmap the image. Its view must not be used afterwards*/
+void rbImageClose(RBImage *image) {
+    munmap(image->mapping, image->length);
+    close(image->fd);
+    free(image);
+    return;
+}
+
+/*Turn the image into a compact tree that can be modified, with room for at least room more nodes, and release the
+image handle. The file is mapped again, privately and writable, at the start of a larger anonymous mapping. Pages of
+the file are only copied when they are first written, new nodes go to the anonymous pages, and the file itself is
+never changed. Once the room is used up the tree moves to the heap. Returns NULL, leaving the image open, if the
+mappings cannot be made*/
+RBCTree *rbImageThaw(RBImage *image, uint32_t room) {
+    RBCTree *tree;
+    size_t length;
+    char *mapping;
+    length = image->length + (size_t)room * sizeof(RBCNode);
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    if (mmap(mapping, image->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image->fd, 0) == MAP_FAILED) {
+        munmap(mapping, length);
+        return NULL;
+    }
+    tree = malloc(sizeof(RBCTree));
+    tree->nodes = (RBCNode *)(mapping + sizeof(RBImageHeader));
+    tree->root = image->view.root;
+    tree->count = image->view.count;
+    tree->capacity = image->view.count + room;
+    tree->mapping = mapping;
+    tree->mappingLength = length;
+    rbImageClose(image);
+    return tree;
+}
+
+/*Return 1 if the links of the count nodes after the sentinel are those of a tree stored in breadth-first order: every
+child index lies after its parent's and within the array, and names its parent back. Descents through such links
+always end at RBC_NIL within count steps*/
+int rbImageCheckLinks(const RBCNode *nodes, uint32_t count) {
+    uint32_t i, parent;
+    for (i = 1; i <= count; i++) {
+        parent = nodes[i].parentColor & ~RBC_RED;
+        if (parent >= i || (nodes[i].left != RBC_NIL && (nodes[i].left <= i || nodes[i].left > count ||
+            (nodes[nodes[i].left].parentColor & ~RBC_RED) != i)) || (nodes[i].right != RBC_NIL &&
+            (nodes[i].right <= i || nodes[i].right > count || (nodes[nodes[i].right].parentColor & ~RBC_RED) != i))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*Return the 64-bit FNV-1a hash of count nodes*/
+uint64_t rbImageChecksum(const RBCNode *nodes, uint32_t count) {
+    const unsigned char *bytes = (const unsigned char *)nodes;
+    size_t i, length = (size_t)count * sizeof(RBCNode);
+    uint64_t hash = 14695981039346656037ULL;
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*Export the keys of the tree into a new immutable snapshot. The tree is walked with rbTreeSuccessor and is left
+unchanged, so the snapshot can be rebuilt from it later. A key with several copies in a multiset is stored once per
+copy, so ranges count every copy as they would in a tree of duplicates*/
+RBSnapshot *rbTreeFreeze(RBTree *rbTree) {
+    RBSnapshot *snapshot;
+    RBTNode *node;
+    int i, j, l, blocks, count = 0;
+    for (node = rbTree->root == rbTree->nil ? rbTree->nil : rbTreeMin(rbTree, rbTree->root); node != rbTree->nil;
+        node = rbTreeSuccessor(rbTree, node)) {
+        count += node->count;
+    }
+    snapshot = malloc(sizeof(RBSnapshot));
+    snapshot->n = count;
+    blocks = (count + RB_SNAPSHOT_B - 1) / RB_SNAPSHOT_B;
+    if (blocks == 0) {
+        blocks = 1;
+    }
+    //Blocks are a multiple of 64 bytes, so every level can be cache-line aligned
+    snapshot->level[0] = aligned_alloc(64, blocks * RB_SNAPSHOT_B * sizeof(int));
+    snapshot->blocks[0] = blocks;
+    i = 0;
+    for (node = rbTree->root == rbTree->nil ? rbTree->nil : rbTreeMin(rbTree, rbTree->root); node != rbTree->nil;
+        node = rbTreeSuccessor(rbTree, node)) {
+        for (j = 0; j < node->count; j++) {
+            snapshot->level[0][i++] = node->item;
+        }
+    }
+    for (; i < blocks * RB_SNAPSHOT_B; i++) {
+        snapshot->level[0][i] = INT_MAX;
+    }
+    //Each level above stores the last, and therefore largest, key of every block in the level below
+    for (l = 1; snapshot->blocks[l - 1] > 1; l++) {
+        count = snapshot->blocks[l - 1];
+        blocks = (count + RB_SNAPSHOT_B - 1) / RB_SNAPSHOT_B;
+        snapshot->level[l] = aligned_alloc(64, blocks * RB_SNAPSHOT_B * sizeof(int));
+        snapshot->blocks[l] = blocks;
+        for (j = 0; j < count; j++) {
+            snapshot->level[l][j] = snapshot->level[l - 1][j * RB_SNAPSHOT_B + RB_SNAPSHOT_B - 1];
+        }
+        for (; j < blocks * RB_SNAPSHOT_B; j++) {
+            snapshot->level[l][j] = INT_MAX;
+        }
+    }
+    snapshot->levels = l;
+    return snapshot;
+}
+
+/*Release a snapshot created by rbTreeFreeze*/
+void rbSnapshotDestroy(RBSnapshot *snapshot) {
+    int l;
+    for (l = 0; l < snapshot->levels; l++) {
+        free(snapshot->level[l]);
+    }
+    free(snapshot);
+    return;
+}
+
+/*Return how many of the RB_SNAPSHOT_B keys in a block are less than key. With AVX2 this is two 8-lane compares and
+with SSE2 four 4-lane compares, whose masks are combined and counted. Define RB_SNAPSHOT_SCALAR to force the plain
+loop*/
+int rbSnapshotBlockRank(const int *block, int key) {
+#if defined(__AVX2__) && !defined(RB_SNAPSHOT_SCALAR)
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i lo = _mm256_cmpgt_epi32(k, _mm256_load_si256((const __m256i *)block));
+    __m256i hi = _mm256_cmpgt_epi32(k, _mm256_load_si256((const __m256i *)(block + 8)));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+        ((unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8);
+    return __builtin_popcount(mask);
+#elif defined(__SSE2__) && !defined(RB_SNAPSHOT_SCALAR)
+    __m128i k = _mm_set1_epi32(key);
+    unsigned mask = 0;
+    int i;
+    for (i = 0; i < RB_SNAPSHOT_B; i += 4) {
+        mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k,
+            _mm_load_si128((const __m128i *)(block + i))))) << i;
+    }
+    return __builtin_popcount(mask);
+#else
+    int i, rank = 0;
+    for (i = 0; i < RB_SNAPSHOT_B; i++) {
+        rank += block[i] < key;
+    }
+    return rank;
+#endif
+}
+
+/*Return the index in the sorted keys of the first key that is not less than key, or n if every key is less*/
+int rbSnapshotLowerBound(const RBSnapshot *snapshot, int key) {
+    int l, block = 0, rank;
+    for (l = snapshot->levels - 1; l >= 0; l--) {
+        rank = rbSnapshotBlockRank(snapshot->level[l] + block * RB_SNAPSHOT_B, key);
+        block = block * RB_SNAPSHOT_B + rank;
+        //Every key is less than key, or we followed padding past the last real block
+        if (rank == RB_SNAPSHOT_B || (l > 0 && block >= snapshot->blocks[l - 1])) {
+            return snapshot->n;
+        }
+    }
+    return block < snapshot->n ? block : snapshot->n;
+}
+
+/*Return 1 if key is in the snapshot and 0 otherwise, giving the same answers as rbIterativeTreeSearch on the tree it
+was frozen from*/
+int rbSnapshotSearch(const RBSnapshot *snapshot, int key) {
+    int i = rbSnapshotLowerBound(snapshot, key);
+    return i < snapshot->n && snapshot->level[0][i] == key;
+}
+
+/*Store in successor the smallest key greater than key and return 1, or return 0 if there is none*/
+int rbSnapshotSuccessor(const RBSnapshot *snapshot, int key, int *successor) {
+    int i;
+    if (key == INT_MAX) {
+        return 0;
+    }
+    i = rbSnapshotLowerBound(snapshot, key + 1);
+    if (i == snapshot->n) {
+        return 0;
+    }
+    *successor = snapshot->level[0][i];
+    return 1;
+}
+
+/*Return the number of keys k with lo <= k <= hi and point first at the smallest of them. The keys are contiguous and
+sorted, so the caller reads them in place*/
+int rbSnapshotRange(const RBSnapshot *snapshot, int lo, int hi, const int **first) {
+    int begin, end;
+    begin = rbSnapshotLowerBound(snapshot, lo);
+    end = hi == INT_MAX ? snapshot->n : rbSnapshotLowerBound(snapshot, hi + 1);
+    *first = snapshot->level[0] + begin;
+    return end > begin ? end - begin : 0;
+}
+
+/*Run the batch engine with the arguments given after "batch" on the command line: an optional -b to select the binary
+format, an optional -s to dump the instrumentation counters as JSON on stderr afterwards, an optional -c to keep
+repeated keys as counts in a multiset, an optional -k to answer searches and deletes through a hot-key cache of
+RB_CACHE_SETS sets, and an optional input file. Operations are read from stdin when no file is given*/
+int rbBatchMain(int argc, char *argv[]) {
+    RBTree *rbTree;
+    RBStats stats;
+    FILE *in = stdin;
+    int binary = 0, dump = 0, multiset = 0, cache = 0;
+    long executed;
+    for (; argc >= 1 && (strcmp(argv[0], "-b") == 0 || strcmp(argv[0], "-s") == 0 || strcmp(argv[0], "-c") == 0 ||
+        strcmp(argv[0], "-k") == 0); argc--, argv++) {
+        if (argv[0][1] == 'b') {
+            binary = 1;
+        } else if (argv[0][1] == 's') {
+            dump = 1;
+        } else if (argv[0][1] == 'c') {
+            multiset = 1;
+        } else {
+            cache = 1;
+        }
+    }
+    if (argc >= 1 && (in = fopen(argv[0], binary ? "rb" : "r")) == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[0]);
+        return 1;
+    }
+    rbTree = rbTreeCreate();
+    rbTree->multiset = multiset;
+    if (cache) {
+        rbCacheEnable(rbTree, RB_CACHE_SETS);
+    }
+    executed = rbRunBatch(rbTree, in, stdout, binary);
+    rbTreeDestroy(rbTree);
+    if (dump) {
+        rbStatsCollect(&stats);
+        rbStatsPrint(&stats, stderr, 1);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    return executed < 0 ? 1 : 0;
+}
+
+/*Read operations from in until it is exhausted and run them back to back on the tree. All output goes through one
+large buffer that is written to out when it fills up and once at the end. Returns the number of operations run, or
+-1 if the input is malformed*/
+long rbRunBatch(RBTree *rbTree, FILE *in, FILE *out, int binary) {
+    RBReader *reader;
+    RBWriter *writer;
+    RBCommand command;
+    long executed = 0;
+    int status;
+    reader = malloc(sizeof(RBReader));
+    writer = malloc(sizeof(RBWriter));
+    reader->in = in;
+    reader->pos = reader->len = 0;
+    writer->out = out;
+    writer->len = 0;
+    while ((status = binary ? rbReadBinaryCommand(reader, &command) : rbReadTextCommand(reader, &command)) > 0) {
+        rbExecuteCommand(rbTree, &command, writer);
+        executed++;
+    }
+    rbWriterFlush(writer);
+    if (status < 0) {
+        fprintf(stderr, "Malformed operation after %ld operations\n", executed);
+        executed = -1;
+    }
+    free(reader);
+    free(writer);
+    return executed;
+}
+
+/*Apply one operation to the tree and append its output, if any, to writer. Searches and deletes write 1 or 0 and
+return 1 if the key was found, range and dump write the matching keys on one line. writer may be NULL for operations
+other than range and dump, in which case only the return value reports the outcome*/
+int rbExecuteCommand(RBTree *rbTree, const RBCommand *command, RBWriter *writer) {
+    RBTNode *node;
+    RBIterator iterator;
+    int found = 0, key;
+    switch (command->op) {
+    case 'i':
+        if (rbTree->multiset) {
+            rbMultisetAdd(rbTree, command->a);
+        } else {
+            rbTreeInsert(rbTree, rbNodeAlloc(rbTree, command->a));
+        }
+        return 1;
+    case 's':
+        found = rbCachedSearch(rbTree, command->a) != rbTree->nil;
+        if (writer != NULL) {
+            rbWriteChar(writer, found ? '1' : '0');
+            rbWriteChar(writer, '\n');
+        }
+        return found;
+    case 'd':
+        if (rbTree->multiset) {
+            found = rbMultisetRemove(rbTree, command->a, 1);
+        } else if ((node = rbCachedSearch(rbTree, command->a)) != rbTree->nil) {
+            treeDelete(rbTree, node);
+            rbNodeFree(rbTree, node);
+            found = 1;
+        }
+        if (writer != NULL) {
+            rbWriteChar(writer, found ? '1' : '0');
+            rbWriteChar(writer, '\n');
+        }
+        return found;
+    case 'p':
+        if (rbTree->multiset) {
+            found = rbMultisetRangeScan(rbTree, INT_MIN, INT_MAX, rbWriteKeyCopies, writer);
+            rbWriteChar(writer, '\n');
+            return found;
+        }
+        rbIteratorInit(rbTree, &iterator);
+        while (rbIteratorNext(&iterator, &key)) {
+            rbWriteInt(writer, key);
+            rbWriteChar(writer, ' ');
+            found++;
+        }
+        rbWriteChar(writer, '\n');
+        return found;
+    case 'r':
+        if (rbTree->multiset) {
+            found = rbMultisetRangeScan(rbTree, command->a, command->b, rbWriteKeyCopies, writer);
+        } else {
+            found = rbTreeRangeScan(rbTree, command->a, command->b, rbWriteKey, writer);
+        }
+        rbWriteChar(writer, '\n');
+        return found;
+    default:
+        return 0;
+    }
+}
+
+/*Return the next byte of input without consuming it, refilling the buffer when it runs out, or -1 at end of input*/
+int rbReaderPeek(RBReader *reader) {
+    if (reader->pos == reader->len) {
+        reader->pos = 0;
+        reader->len = fread(reader->buf, 1, RB_IO_BUFFER, reader->in);
+        if (reader->len == 0) {
+            return -1;
+        }
+    }
+    return reader->buf[reader->pos];
+}
+
+/*Parse an optionally signed decimal integer after skipping blanks on the current line. Returns 0 if there is none or
+if it does not fit in an int*/
+int rbReadInt(RBReader *reader, int *value) {
+    int c, negative = 0, digits = 0, overflow = 0;
+    unsigned result = 0, limit;
+    while ((c = rbReaderPeek(reader)) == ' ' || c == '\t') {
+        reader->pos++;
+    }
+    if (c == '-') {
+        negative = 1;
+        reader->pos++;
+    }
+    limit = (unsigned)INT_MAX + (unsigned)negative; //The magnitude of INT_MIN is one more than INT_MAX
+    while ((c = rbReaderPeek(reader)) >= '0' && c <= '9') {
+        if (result > (limit - (unsigned)(c - '0')) / 10) {
+            overflow = 1; //Keep consuming the digits so the rest of the number is not read as another operand
+        } else {
+            result = result * 10 + (unsigned)(c - '0');
+        }
+        reader->pos++;
+        digits++;
+    }
+    *value = negative ? (int)(0u - result) : (int)result;
+    return digits > 0 && !overflow;
+}
+
+/*Parse the next text operation into command. Blank lines and lines starting with # are skipped. Returns 1 if an
+operation was read, 0 at end of input and -1 if the input is malformed*/
+int rbReadTextCommand(RBReader *reader, RBCommand *command) {
+    int c;
+    for (;;) {
+        c = rbReaderPeek(reader);
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            reader->pos++;
+        } else if (c == '#') {
+            while ((c = rbReaderPeek(reader)) != -1 && c != '\n') {
+                reader->pos++;
+            }
+        } else {
+            break;
+        }
+    }
+    if (c == -1) {
+        return 0;
+    }
+    reader->pos++;
+    command->op = (char)c;
+    switch (c) {
+    case 'i':
+    case 'd':
+    case 's':
+        return rbReadInt(reader, &(command->a)) ? 1 : -1;
+    case 'r':
+        return rbReadInt(reader, &(command->a)) && rbReadInt(reader, &(command->b)) ? 1 : -1;
+    case 'p':
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+/*Decode the next binary operation into command. Returns 1 if an operation was read, 0 at end of input and -1 if the
+input is malformed or truncated*/
+int rbReadBinaryCommand(RBReader *reader, RBCommand *command) {
+    int c, i, j, args;
+    uint32_t value;
+    if ((c = rbReaderPeek(reader)) == -1) {
+        return 0;
+    }
+    reader->pos++;
+    command->op = (char)c;
+    args = (c == 'r') ? 2 : (c == 'p') ? 0 : (c == 'i' || c == 'd' || c == 's') ? 1 : -1;
+    for (i = 0; i < args; i++) {
+        value = 0;
+        for (j = 0; j < 4; j++) {
+            if ((c = rbReaderPeek(reader)) == -1) {
+                return -1;
+            }
+            reader->pos++;
+            value |= (uint32_t)c << (8 * j);
+        }
+        if (i == 0) {
+            command->a = (int)value;
+        } else {
+            command->b = (int)value;
+        }
+    }
+    return args < 0 ? -1 : 1;
+}
+
+/*Append one character to the output buffer, writing the buffer out when it is full*/
+void rbWriteChar(RBWriter *writer, char c) {
+    if (writer->len == RB_IO_BUFFER) {
+        rbWriterFlush(writer);
+    }
+    writer->buf[writer->len++] = c;
+    return;
+}
+
+/*Append the decimal form of value to the output buffer without going through printf*/
+void rbWriteInt(RBWriter *writer, int value) {
+    char digits[12];
+    int count = 0;
+    unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    if (writer->len + sizeof(digits) > RB_IO_BUFFER) {
+        rbWriterFlush(writer);
+    }
+    if (value < 0) {
+        writer->buf[writer->len++] = '-';
+    }
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    while (count > 0) {
+        writer->buf[writer->len++] = digits[--count];
+    }
+    return;
+}
+
+/*Range scan visitor that appends key and a separating space to the RBWriter passed as context*/
+int rbWriteKey(int key, void *writer) {
+    rbWriteInt(writer, key);
+    rbWriteChar(writer, ' ');
+    return 0;
+}
+
+/*Multiset range scan visitor that writes key once per copy, so a multiset prints the same as a tree of duplicates*/
+int rbWriteKeyCopies(int key, int count, void *writer) {
+    while (count-- > 0) {
+        rbWriteKey(key, writer);
+    }
+    return 0;
+}
+
+/*Write out everything in the output buffer*/
+void rbWriterFlush(RBWriter *writer) {
+    fwrite(writer->buf, 1, writer->len, writer->out);
+    fflush(writer->out);
+    writer->len = 0;
+    return;
+}
+
+/*Create an empty tree for concurrent readers*/
+RBRcuTree *rbRcuTreeCreate(void) {
+    RBRcuTree *tree;
+    int i;
+    tree = malloc(sizeof(RBRcuTree));
+    atomic_init(&(tree->root), NULL);
+    atomic_init(&(tree->epoch), 1);
+    for (i = 0; i < RB_RCU_READERS; i++) {
+        tree->readers[i].tree = tree;
+        atomic_init(&(tree->readers[i].epoch), 0);
+        atomic_init(&(tree->readers[i].used), 0);
+    }
+    pthread_mutex_init(&(tree->writer), NULL);
+    tree->limbo = tree->limboTail = NULL;
+    tree->store.counted = 0;
+    tree->store.freeList = NULL;
+    tree->store.live = 0;
+    tree->store.retiringCount = 0;
+    return tree;
+}
+
+/*Release the tree along with every retired node. No reader may be using it any more*/
+void rbRcuTreeDestroy(RBRcuTree *tree) {
+    RBRcuRetired *batch, *next;
+    RBPNode *node;
+    int i;
+    rbPSubtreeFree(atomic_load(&(tree->root)));
+    for (batch = tree->limbo; batch != NULL; batch = next) {
+        next = batch->next;
+        for (i = 0; i < batch->count; i++) {
+            free(batch->nodes[i]);
+        }
+        free(batch);
+    }
+    while ((node = tree->store.freeList) != NULL) {
+        tree->store.freeList = node->left;
+        free(node);
+    }
+    pthread_mutex_destroy(&(tree->writer));
+    free(tree);
+    return;
+}
+
+/*Free every node of the subtree rooted at node. The recursion is no deeper than the tree*/
+void rbPSubtreeFree(RBPNode *node) {
+    if (node != NULL) {
+        rbPSubtreeFree(node->left);
+        rbPSubtreeFree(node->right);
+        free(node);
+    }
+    return;
+}
+
+/*Claim a reader slot for the calling thread. Returns NULL if all RB_RCU_READERS slots are taken*/
+RBRcuReader *rbRcuRegister(RBRcuTree *tree) {
+    int i, expected;
+    for (i = 0; i < RB_RCU_READERS; i++) {
+        expected = 0;
+        if (atomic_compare_exchange_strong(&(tree->readers[i].used), &expected, 1)) {
+            return &(tree->readers[i]);
+        }
+    }
+    return NULL;
+}
+
+/*Give the reader's slot back. The reader must not be inside a read*/
+void rbRcuUnregister(RBRcuReader *reader) {
+    atomic_store(&(reader->used), 0);
+    return;
+}
+
+/*Enter a read. Until the matching rbRcuReadUnlock, no node reachable from a root loaded by this reader is freed*/
+void rbRcuReadLock(RBRcuReader *reader) {
+    atomic_store(&(reader->epoch), atomic_load(&(reader->tree->epoch)));
+    return;
+}
+
+/*Leave a read*/
+void rbRcuReadUnlock(RBRcuReader *reader) {
+    atomic_store(&(reader->epoch), 0);
+    return;
+}
+
+/*Return 1 if the current version of the tree holds key. Takes no lock and never waits for the writer*/
+int rbRcuSearch(RBRcuReader *reader, int key) {
+    RBPNode *node;
+    rbRcuReadLock(reader);
+    node = atomic_load(&(reader->tree->root));
+    while (node != NULL && node->item != key) {
+        node = key < node->item ? node->left : node->right;
+    }
+    rbRcuReadUnlock(reader);
+    return node != NULL;
+}
+
+/*Call visit on every item k with lo <= k <= hi of the current version in sorted order, like rbTreeRangeScan, and
+return the number of items visited. The whole scan sees the one version that was current when it started*/
+int rbRcuRangeScan(RBRcuReader *reader, int lo, int hi, int (*visit)(int key, void *context), void *context) {
+    int count;
+    rbRcuReadLock(reader);
+    count = rbPRangeScan(atomic_load(&(reader->tree->root)), lo, hi, visit, context);
+    rbRcuReadUnlock(reader);
+    return count;
+}
+
+/*Range scan of the path-copied subtree rooted at root. Without parent pointers the successors come from an explicit
+stack of the nodes still to be visited*/
+int rbPRangeScan(RBPNode *root, int lo, int hi, int (*visit)(int key, void *context), void *context) {
+    RBPNode *stack[RB_PATH_MAX], *node = root;
+    int top = 0, count = 0;
+    while (node != NULL || top > 0) {
+        //Descend towards lo, stacking the nodes that still have to be visited after their left subtrees
+        while (node != NULL) {
+            if (node->item < lo) {
+                node = node->right;
+            } else {
+                stack[top++] = node;
+                node = node->left;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        node = stack[--top];
+        if (node->item > hi) {
+            break;
+        }
+        count++;
+        if (visit(node->item, context)) {
+            break;
+        }
+        node = node->right;
+    }
+    return count;
+}
+
+/*Insert key into a new version of the tree and publish it. Returns 1*/
+int rbRcuInsert(RBRcuTree *tree, int key) {
+    pthread_mutex_lock(&(tree->writer));
+    rbRcuPublish(tree, rbPInsert(&(tree->store), atomic_load(&(tree->root)), key));
+    pthread_mutex_unlock(&(tree->writer));
+    return 1;
+}
+
+/*Delete one occurrence of key from a new version of the tree and publish it. Returns 0 if key is not in the tree*/
+int rbRcuDelete(RBRcuTree *tree, int key) {
+    RBPNode *root;
+    int found;
+    pthread_mutex_lock(&(tree->writer));
+    root = rbPDelete(&(tree->store), atomic_load(&(tree->root)), key, &found);
+    if (found) {
+        rbRcuPublish(tree, root);
+    }
+    pthread_mutex_unlock(&(tree->writer));
+    return found;
+}
+
+/*Insert key into the path-copied tree rooted at root and return the root of the new version, leaving the old one
+intact. Every node on the search path is copied, then the usual insert fixup runs on the copies, climbing the stack of
+copied nodes instead of parent pointers. An uncle that has to be recolored is copied as well, so an insert replaces
+O(log n) nodes*/
+RBPNode *rbPInsert(RBPStore *store, RBPNode *root, int key) {
+    RBPNode *path[RB_PATH_MAX], *node, *parent, *grand, *uncle;
+    int depth = 0, i;
+    if (root != NULL) {
+        if (store->counted) {
+            root->refs++; //The new version starts out sharing the old root
+        }
+        root = rbPNodeCopy(store, root);
+    }
+    for (node = root; node != NULL; node = key < node->item ? node->left : node->right) {
+        path[depth++] = node;
+        if (key < node->item) {
+            if (node->left != NULL) {
+                node->left = rbPNodeCopy(store, node->left);
+            }
+        } else if (node->right != NULL) {
+            node->right = rbPNodeCopy(store, node->right);
+        }
+    }
+    node = rbPNodeAlloc(store, key);
+    if (depth == 0) {
+        root = node;
+    } else if (key < path[depth - 1]->item) {
+        path[depth - 1]->left = node;
+    } else {
+        path[depth - 1]->right = node;
+    }
+    path[depth] = node;
+    //path[i] is the red node and path[i - 1] its parent. A red parent is never the root, so path[i - 2] exists
+    for (i = depth; i >= 2 && path[i - 1]->color == 1; ) {
+        node = path[i];
+        parent = path[i - 1];
+        grand = path[i - 2];
+        uncle = parent == grand->left ? grand->right : grand->left;
+        if (RBP_IS_RED(uncle)) {
+            uncle = rbPNodeCopy(store, uncle);
+            if (parent == grand->left) {
+                grand->right = uncle;
+            } else {
+                grand->left = uncle;
+            }
+            parent->color = 0;
+            uncle->color = 0;
+            grand->color = 1;
+            i -= 2;
+        } else {
+            if (parent == grand->left) {
+                if (node == parent->right) {
+                    parent = grand->left = rbPRotateLeft(parent);
+                }
+                node = rbPRotateRight(grand);
+            } else {
+                if (node == parent->left) {
+                    parent = grand->right = rbPRotateRight(parent);
+                }
+                node = rbPRotateLeft(grand);
+            }
+            parent->color = 0;
+            grand->color = 1;
+            rbPReplaceChild(path, i - 3, &root, grand, node);
+            break;
+        }
+    }
+    root->color = 0;
+    return root;
+}
+
+/*Delete one occurrence of key from the path-copied tree rooted at root and return the root of the new version, leaving
+the old one intact. found is set to 0, and root returned unchanged, if key is not in the tree. The path down to the
+node that is actually unlinked, which is the successor when the node holding key has two children, is copied, and the
+CLRS delete fixup runs on the copies. A sibling, or a sibling's child, the fixup recolors or rotates is copied first, so
+the update replaces O(log n) nodes*/
+RBPNode *rbPDelete(RBPStore *store, RBPNode *root, int key, int *found) {
+    RBPNode *path[RB_PATH_MAX], *node, *target, *child, *parent, *sibling;
+    int depth, i, left, black, inner;
+    for (node = root; node != NULL && node->item != key; node = key < node->item ? node->left : node->right)
+        ;
+    *found = node != NULL;
+    if (node == NULL) {
+        return root;
+    }
+    //Copy the path down to the node holding key
+    if (store->counted) {
+        root->refs++;
+    }
+    root = rbPNodeCopy(store, root);
+    for (node = root, depth = 0; node->item != key; ) {
+        path[depth++] = node;
+        if (key < node->item) {
+            node = node->left = rbPNodeCopy(store, node->left);
+        } else {
+            node = node->right = rbPNodeCopy(store, node->right);
+        }
+    }
+    target = node;
+    if (node->left != NULL && node->right != NULL) {
+        //Continue to the successor, which takes over its item and is unlinked in its place
+        path[depth++] = node;
+        node = node->right = rbPNodeCopy(store, node->right);
+        while (node->left != NULL) {
+            path[depth++] = node;
+            node = node->left = rbPNodeCopy(store, node->left);
+        }
+        target->item = node->item;
+    }
+    //node has at most one child, which takes its place
+    child = node->left != NULL ? node->left : node->right;
+    left = depth > 0 && path[depth - 1]->left == node;
+    black = node->color == 0;
+    if (black && RBP_IS_RED(child)) {
+        //A red child turned black makes up for the removed black node
+        child = rbPNodeCopy(store, child);
+        child->color = 0;
+        black = 0;
+    }
+    rbPReplaceChild(path, depth - 1, &root, node, child);
+    rbPNodeDrop(store, node);
+    //The subtree below path[i] on the left side or the right side carries one black too few
+    for (i = depth - 1; black && i >= 0; ) {
+        parent = path[i];
+        sibling = left ? parent->right : parent->left;
+        if (sibling->color == 1) {
+            //Case 1: rotate the red sibling above parent, which leaves parent with a black sibling
+            sibling = rbPNodeCopy(store, sibling);
+            sibling->color = 0;
+            parent->color = 1;
+            if (left) {
+                parent->right = sibling;
+                rbPReplaceChild(path, i - 1, &root, parent, rbPRotateLeft(parent));
+            } else {
+                parent->left = sibling;
+                rbPReplaceChild(path, i - 1, &root, parent, rbPRotateRight(parent));
+            }
+            path[i + 1] = parent;
+            path[i++] = sibling;
+            sibling = left ? parent->right : parent->left;
+        }
+        sibling = rbPNodeCopy(store, sibling);
+        if (left) {
+            parent->right = sibling;
+        } else {
+            parent->left = sibling;
+        }
+        if (!RBP_IS_RED(sibling->left) && !RBP_IS_RED(sibling->right)) {
+            //Case 2: move the missing black up to parent
+            sibling->color = 1;
+            if (parent->color == 1) {
+                parent->color = 0;
+                black = 0;
+            } else if (i > 0) {
+                left = path[i - 1]->left == parent;
+            }
+            i--;
+            continue;
+        }
+        inner = left ? !RBP_IS_RED(sibling->right) : !RBP_IS_RED(sibling->left);
+        if (inner && left) {
+            //Case 3: turn the sibling's red child into the outer one
+            sibling->left = rbPNodeCopy(store, sibling->left);
+            sibling->left->color = 0;
+            sibling->color = 1;
+            sibling = parent->right = rbPRotateRight(sibling);
+        } else if (inner) {
+            sibling->right = rbPNodeCopy(store, sibling->right);
+            sibling->right->color = 0;
+            sibling->color = 1;
+            sibling = parent->left = rbPRotateLeft(sibling);
+        }
+        //Case 4: rotate the sibling above parent and blacken its outer child, which restores the black-height. After
+        //case 3 the outer child is the old sibling, which is already a copy
+        sibling->color = parent->color;
+        parent->color = 0;
+        if (left) {
+            if (!inner) {
+                sibling->right = rbPNodeCopy(store, sibling->right);
+            }
+            sibling->right->color = 0;
+            rbPReplaceChild(path, i - 1, &root, parent, rbPRotateLeft(parent));
+        } else {
+            if (!inner) {
+                sibling->left = rbPNodeCopy(store, sibling->left);
+            }
+            sibling->left->color = 0;
+            rbPReplaceChild(path, i - 1, &root, parent, rbPRotateRight(parent));
+        }
+        black = 0;
+    }
+    if (root != NULL) {
+        root->color = 0;
+    }
+    return root;
+}
+
+/*Return a new red node with no children, reusing a reclaimed node if there is one*/
+RBPNode *rbPNodeAlloc(RBPStore *store, int item) {
+    RBPNode *node = store->freeList;
+    if (node != NULL) {
+        store->freeList = node->left;
+    } else {
+        node = malloc(sizeof(RBPNode));
+    }
+    store->live++;
+    node->item = item;
+    node->color = 1;
+    node->refs = 1;
+    node->left = node->right = NULL;
+    return node;
+}
+
+/*Return a private copy, which the update may change, of a shared node that is linked from a private node. The copy
+takes over that link: a reference counted store moves the reference from the original to the copy and lets the copy
+share the children, while any other store retires the original*/
+RBPNode *rbPNodeCopy(RBPStore *store, RBPNode *node) {
+    RBPNode *copy = rbPNodeAlloc(store, node->item);
+    copy->color = node->color;
+    copy->left = node->left;
+    copy->right = node->right;
+    if (store->counted) {
+        if (copy->left != NULL) {
+            copy->left->refs++;
+        }
+        if (copy->right != NULL) {
+            copy->right->refs++;
+        }
+        node->refs--; //Never reaches zero here, the old version still holds the node
+    } else {
+        store->retiring[store->retiringCount++] = node;
+    }
+    return copy;
+}
+
+/*Dispose of a private node that an update unlinked after moving its children elsewhere*/
+void rbPNodeDrop(RBPStore *store, RBPNode *node) {
+    if (store->counted) {
+        node->left = store->freeList;
+        store->freeList = node;
+        store->live--;
+    } else {
+        store->retiring[store->retiringCount++] = node; //Never published, but simplest to reclaim with the rest
+    }
+    return;
+}
+
+/*Drop one reference to node in a reference counted store, freeing it and releasing its children once nothing shares it.
+The recursion only follows nodes that are being freed, so it is no deeper than the tree*/
+void rbPNodeRelease(RBPStore *store, RBPNode *node) {
+    if (node != NULL && --node->refs == 0) {
+        rbPNodeRelease(store, node->left);
+        rbPNodeRelease(store, node->right);
+        node->left = store->freeList;
+        store->freeList = node;
+        store->live--;
+    }
+    return;
+}
+
+/*Create a reference counted store for persistent versions. Versions built from one another must share a store, and
+a store serves one thread at a time*/
+RBPStore *rbPStoreCreate(void) {
+    RBPStore *store = malloc(sizeof(RBPStore));
+    store->counted = 1;
+    store->freeList = NULL;
+    store->live = 0;
+    store->retiringCount = 0;
+    return store;
+}
+
+/*Release the store. Every version created from it must have been released*/
+void rbPStoreDestroy(RBPStore *store) {
+    RBPNode *node;
+    while ((node = store->freeList) != NULL) {
+        store->freeList = node->left;
+        free(node);
+    }
+    free(store);
+    return;
+}
+
+/*Return a handle on the empty version*/
+RBVersion *rbVersionCreate(RBPStore *store) {
+    return rbVersionWrap(store, NULL, 0);
+}
+
+/*Return a new handle on the version rooted at root, taking over one reference to root*/
+RBVersion *rbVersionWrap(RBPStore *store, RBPNode *root, int count) {
+    RBVersion *version = malloc(sizeof(RBVersion));
+    version->store = store;
+    version->root = root;
+    version->count = count;
+    version->refs = 1;
+    return version;
+}
+
+/*Return a new version holding the items of version plus key. version is left unchanged and stays valid, and the two
+share all but the O(log n) nodes on the insert path, which is all the memory the update takes*/
+RBVersion *rbVersionInsert(RBVersion *version, int key) {
+    return rbVersionWrap(version->store, rbPInsert(version->store, version->root, key), version->count + 1);
+}
+
+/*Return a new version holding the items of version without one occurrence of key. version is left unchanged. If key
+is not in version the new version shares its root*/
+RBVersion *rbVersionDelete(RBVersion *version, int key) {
+    RBPNode *root;
+    int found;
+    root = rbPDelete(version->store, version->root, key, &found);
+    if (!found && root != NULL) {
+        root->refs++;
+    }
+    return rbVersionWrap(version->store, root, version->count - found);
+}
+
+/*Take another hold on version, which then needs one more rbVersionRelease*/
+RBVersion *rbVersionRetain(RBVersion *version) {
+    version->refs++;
+    return version;
+}
+
+/*Drop a hold on version. Releasing the last one frees the nodes no other version shares*/
+void rbVersionRelease(RBVersion *version) {
+    if (--version->refs == 0) {
+        rbPNodeRelease(version->store, version->root);
+        free(version);
+    }
+    return;
+}
+
+/*Return 1 if version holds key*/
+int rbVersionSearch(RBVersion *version, int key) {
+    RBPNode *node = version->root;
+    while (node != NULL && node->item != key) {
+        node = key < node->item ? node->left : node->right;
+    }
+    return node != NULL;
+}
+
+/*Rotate left at node, which must be private to the writer like its right child, and return the new subtree root*/
+RBPNode *rbPRotateLeft(RBPNode *node) {
+    RBPNode *rNode = node->right;
+    node->right = rNode->left;
+    rNode->left = node;
+    return rNode;
+}
+
+RBPNode *rbPRotateRight(RBPNode *node) {
+    RBPNode *lNode = node->left;
+    node->left = lNode->right;
+    lNode->right = node;
+    return lNode;
+}
+
+/*Make node take the place of old below path[depth], or at the root if depth is negative*/
+void rbPReplaceChild(RBPNode **path, int depth, RBPNode **root, RBPNode *old, RBPNode *node) {
+    if (depth < 0) {
+        *root = node;
+    } else if (path[depth]->left == old) {
+        path[depth]->left = node;
+    } else {
+        path[depth]->right = node;
+    }
+    return;
+}
+
+/*Publish root as the current version and advance the epoch. The nodes the update replaced are tagged with the epoch it
+was published in. A reader may hold them only if it entered its read no later than that epoch, so every batch older
+than the oldest epoch still held by a reader can be reclaimed*/
+void rbRcuPublish(RBRcuTree *tree, RBPNode *root) {
+    RBRcuRetired *batch;
+    unsigned long long oldest = ULLONG_MAX, epoch;
+    int i;
+    atomic_store(&(tree->root), root);
+    batch = malloc(sizeof(RBRcuRetired) + tree->store.retiringCount * sizeof(RBPNode *));
+    batch->next = NULL;
+    batch->epoch = atomic_fetch_add(&(tree->epoch), 1);
+    batch->count = tree->store.retiringCount;
+    memcpy(batch->nodes, tree->store.retiring, tree->store.retiringCount * sizeof(RBPNode *));
+    tree->store.retiringCount = 0;
+    if (tree->limboTail == NULL) {
+        tree->limbo = batch;
+    } else {
+        tree->limboTail->next = batch;
+    }
+    tree->limboTail = batch;
+    for (i = 0; i < RB_RCU_READERS; i++) {
+        epoch = atomic_load(&(tree->readers[i].epoch));
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    while ((batch = tree->limbo) != NULL && batch->epoch < oldest) {
+        tree->limbo = batch->next;
+        for (i = 0; i < batch->count; i++) {
+            batch->nodes[i]->left = tree->store.freeList;
+            tree->store.freeList = batch->nodes[i];
+        }
+        tree->store.live -= batch->count;
+        free(batch);
+    }
+    if (tree->limbo == NULL) {
+        tree->limboTail = NULL;
+    }
+    return;
+}
+
+/*Create an empty top-down red-black tree. If concurrent is nonzero, searches, inserts and deletes may be called from
+several threads at once*/
+RBTDTree *rbtdTreeCreate(int concurrent) {
+    RBTDTree *tree = malloc(sizeof(RBTDTree));
+    tree->head.item = 0;
+    tree->head.color = 0;
+    atomic_flag_clear(&(tree->head.lock));
+    tree->head.link[0] = NULL;
+    tree->head.link[1] = NULL;
+    tree->concurrent = concurrent;
+    return tree;
+}
+
+/*Free every node of the tree along with the tree itself. Left children are rotated up until the current node has none,
+as in treeDeleteAll, so no stack is needed*/
+void rbtdTreeDestroy(RBTDTree *tree) {
+    RBTDNode *node = tree->head.link[1], *next;
+    while (node != NULL) {
+        if (node->link[0] == NULL) {
+            next = node->link[1];
+            free(node);
+        } else {
+            next = node->link[0];
+            node->link[0] = next->link[1];
+            next->link[1] = node;
+        }
+        node = next;
+    }
+    free(tree);
+    return;
+}
+
+/*Return a new red leaf holding item. Nodes are malloc'd one at a time since concurrent writers allocate and free
+them without any lock in common*/
+RBTDNode *rbtdNodeAlloc(int item) {
+    RBTDNode *node = malloc(sizeof(RBTDNode));
+    node->item = item;
+    node->color = 1;
+    atomic_flag_clear(&(node->lock));
+    node->link[0] = NULL;
+    node->link[1] = NULL;
+    return node;
+}
+
+/*Lock node unless the operation already holds it. Locks are only ever taken on a child of a node the operation holds,
+and given up from the top, so an operation only waits for one that is further down and cannot deadlock*/
+void rbtdAcquire(RBTDLocks *locks, RBTDNode *node) {
+    int i;
+    if (!locks->active || node == NULL) {
+        return;
+    }
+    for (i = 0; i < locks->count; i++) {
+        if (locks->nodes[i] == node) {
+            return;
+        }
+    }
+    while (atomic_flag_test_and_set_explicit(&(node->lock), memory_order_acquire)) {
+        sched_yield();
+    }
+    locks->nodes[locks->count++] = node;
+    return;
+}
+
+/*Unlock every node the operation holds except the count nodes of keep, which may contain NULL*/
+void rbtdRelease(RBTDLocks *locks, RBTDNode **keep, int count) {
+    int i, j;
+    for (i = 0; i < locks->count; ) {
+        for (j = 0; j < count && keep[j] != locks->nodes[i]; j++) {
+        }
+        if (j < count) {
+            i++;
+            continue;
+        }
+        atomic_flag_clear_explicit(&(locks->nodes[i]->lock), memory_order_release);
+        locks->nodes[i] = locks->nodes[--(locks->count)];
+    }
+    return;
+}
+
+/*Rotate node towards dir, so that its child on the other side takes its place, and return that child. The child is
+colored black and node red, which is what both top-down passes need after a rotation*/
+RBTDNode *rbtdRotate(RBTDNode *node, int dir) {
+    RBTDNode *child = node->link[!dir];
+    node->link[!dir] = child->link[dir];
+    child->link[dir] = node;
+    node->color = 1;
+    child->color = 0;
+    return child;
+}
+
+/*Rotate the child of node on the side opposite dir away from dir, then node towards dir. Returns the grandchild that
+ends up in node's place*/
+RBTDNode *rbtdRotateDouble(RBTDNode *node, int dir) {
+    node->link[!dir] = rbtdRotate(node->link[!dir], !dir);
+    return rbtdRotate(node, dir);
+}
+
+/*Return 1 if key is in the tree. In a concurrent tree the search holds the node it is on and locks the next one before
+letting go of it*/
+int rbtdSearch(RBTDTree *tree, int key) {
+    RBTDLocks locks;
+    RBTDNode *node, *keep[1];
+    locks.count = 0;
+    locks.active = tree->concurrent;
+    rbtdAcquire(&locks, &(tree->head));
+    node = tree->head.link[1];
+    rbtdAcquire(&locks, node);
+    while (node != NULL && key != node->item) {
+        node = node->link[key > node->item];
+        rbtdAcquire(&locks, node);
+        keep[0] = node;
+        rbtdRelease(&locks, keep, 1);
+    }
+    rbtdRelease(&locks, NULL, 0);
+    return node != NULL;
+}
+
+/*Insert key unless it is already in the tree, and return 1 if it was inserted. This is the top-down insertion of
+Guibas and Sedgewick: on the way down, every node with two red children is recolored red with black children, and if
+that leaves two reds in a row, one rotation at the grandparent repairs it on the spot. The leaf is then added below a
+black parent or repaired the same way, so nothing is left to fix above it. A pass only ever changes its current node
+q, the parent p, grandparent g and great-grandparent t, and the colors of q's children*/
+int rbtdInsert(RBTDTree *tree, int key) {
+    RBTDLocks locks;
+    RBTDNode *t = &(tree->head), *g = NULL, *p = NULL, *q, *keep[4];
+    int dir = 1, last = 1, inserted = 0;
+    locks.count = 0;
+    locks.active = tree->concurrent;
+    rbtdAcquire(&locks, t);
+    q = t->link[1];
+    rbtdAcquire(&locks, q);
+    for (;;) {
+        if (q == NULL) {
+            q = rbtdNodeAlloc(key);
+            rbtdAcquire(&locks, q);
+            if (p == NULL) { //The tree was empty
+                q->color = 0;
+                t->link[1] = q;
+            } else {
+                p->link[dir] = q;
+            }
+            inserted = 1;
+        } else {
+            rbtdAcquire(&locks, q->link[0]);
+            rbtdAcquire(&locks, q->link[1]);
+            if (RBTD_RED(q->link[0]) && RBTD_RED(q->link[1])) {
+                //Color flip. The root stays black, which adds one to the black-height of every path
+                q->color = p != NULL;
+                q->link[0]->color = 0;
+                q->link[1]->color = 0;
+            }
+        }
+        if (RBTD_RED(q) && RBTD_RED(p)) {
+            //p is red, so it is not the root and g exists
+            if (q == p->link[last]) {
+                t->link[t->link[1] == g] = rbtdRotate(g, !last);
+            } else {
+                t->link[t->link[1] == g] = rbtdRotateDouble(g, !last);
+            }
+        }
+        if (q->item == key) {
+            break;
+        }
+        last = dir;
+        dir = key > q->item;
+        if (g != NULL) {
+            t = g;
+        }
+        g = p;
+        p = q;
+        q = q->link[dir];
+        keep[0] = t;
+        keep[1] = g;
+        keep[2] = p;
+        keep[3] = q;
+        rbtdRelease(&locks, keep, 4);
+    }
+    rbtdRelease(&locks, NULL, 0);
+    return inserted;
+}
+
+/*Delete key and return 1 if it was in the tree. This is the top-down deletion that goes with rbtdInsert: the pass
+keeps its current node q red, or gives it a red child on the way, by recoloring q, its parent p and its sibling or
+rotating at q or p. Whatever black node is eventually removed is then one whose removal changes no black-height. Like a
+delete in a plain binary search tree, a node with two children takes the item of its predecessor, which is the node
+that is then unlinked*/
+int rbtdDelete(RBTDTree *tree, int key) {
+    RBTDLocks locks;
+    RBTDNode *head = &(tree->head), *q = head, *g = NULL, *p = NULL, *sibling, *found = NULL, *top, *keep[5];
+    int dir = 1, last;
+    locks.count = 0;
+    locks.active = tree->concurrent;
+    rbtdAcquire(&locks, head);
+    rbtdAcquire(&locks, head->link[1]);
+    while (q->link[dir] != NULL) {
+        last = dir;
+        g = p;
+        p = q;
+        q = q->link[dir];
+        dir = key > q->item; //Equal keys go left, towards the predecessor
+        if (q->item == key) {
+            found = q;
+        }
+        rbtdAcquire(&locks, q->link[0]);
+        rbtdAcquire(&locks, q->link[1]);
+        if (!RBTD_RED(q) && !RBTD_RED(q->link[dir])) {
+            if (RBTD_RED(q->link[!dir])) {
+                p->link[last] = rbtdRotate(q, dir);
+                p = p->link[last];
+            } else if ((sibling = p->link[!last]) != NULL) {
+                rbtdAcquire(&locks, sibling);
+                rbtdAcquire(&locks, sibling->link[0]);
+                rbtdAcquire(&locks, sibling->link[1]);
+                if (!RBTD_RED(sibling->link[0]) && !RBTD_RED(sibling->link[1])) {
+                    p->color = 0;
+                    sibling->color = 1;
+                    q->color = 1;
+                } else {
+                    if (RBTD_RED(sibling->link[last])) {
+                        top = rbtdRotateDouble(p, last);
+                    } else {
+                        top = rbtdRotate(p, last);
+                    }
+                    g->link[g->link[1] == p] = top;
+                    q->color = 1;
+                    top->color = g != head; //The root stays black
+                    top->link[0]->color = 0;
+                    top->link[1]->color = 0;
+                }
+            }
+        }
+        keep[0] = p;
+        keep[1] = q;
+        keep[2] = q->link[0];
+        keep[3] = q->link[1];
+        keep[4] = found;
+        rbtdRelease(&locks, keep, 5);
+    }
+    if (found != NULL) {
+        found->item = q->item;
+        p->link[p->link[1] == q] = q->link[q->link[0] == NULL];
+    }
+    rbtdRelease(&locks, NULL, 0);
+    if (found != NULL) {
+        free(q); //Unreachable, and no other operation can be waiting for it since that would take p
+    }
+    return found != NULL;
+}
+
+/*Verify that the tree is a binary search tree of distinct keys with a black root and no red node with a red child,
+and that every path has the same number of black nodes. Returns that number, or -1 if any check fails, and stores
+the number of keys in count. Only call this while no other operation is running*/
+int rbtdCheck(RBTDTree *tree, int *count) {
+    *count = 0;
+    if (RBTD_RED(tree->head.link[1])) {
+        return -1;
+    }
+    return rbtdSubtreeCheck(tree->head.link[1], (long)INT_MIN - 1, (long)INT_MAX + 1, count);
+}
+
+/*Subroutine for rbtdCheck. Every key of the subtree must lie strictly between lo and hi. Adds the number of nodes of
+the subtree to count and returns its black-height, or -1*/
+int rbtdSubtreeCheck(RBTDNode *node, long lo, long hi, int *count) {
+    int left, right;
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->item <= lo || node->item >= hi || (node->color == 1 && (RBTD_RED(node->link[0]) ||
+        RBTD_RED(node->link[1])))) {
+        return -1;
+    }
+    (*count)++;
+    left = rbtdSubtreeCheck(node->link[0], lo, node->item, count);
+    right = rbtdSubtreeCheck(node->link[1], node->item, hi, count);
+    if (left < 0 || left != right) {
+        return -1;
+    }
+    return left + (node->color == 0);
+}
+
+RBBench rbBenches[] = {
+    {"search", rbBenchSearch, {100000, 1000000, 10000000, 0}},
+    {"compact", rbBenchCompact, {100000, 1000000, 10000000, 0}},
+    {"snapshot", rbBenchSnapshot, {100000, 1000000, 10000000, 0}},
+    {"suite", rbBenchSuite, {1000, 10000, 100000, 0}},
+    {"setops", rbBenchSetOps, {100000, 1000000, 0}},
+    {"rcu", rbBenchRcu, {100000, 1000000, 0}},
+    {"versions", rbBenchVersions, {10000, 100000, 1000000, 0}},
+    {"image", rbBenchImage, {100000, 1000000, 10000000, 0}},
+    {"typed", rbBenchTyped, {100000, 1000000, 10000000, 0}},
+    {"skewed", rbBenchSkewed, {100000, 1000000, 0}},
+    {"hotcache", rbBenchHotCache, {100000, 1000000, 0}},
+    {"finger", rbBenchFinger, {100000, 1000000, 0}},
+    {"buffered", rbBenchBuffered, {100000, 1000000, 0}},
+    {"topdown", rbBenchTopDown, {100000, 1000000, 0}},
+    {"multiset", rbBenchMultiset, {100000, 1000000, 10000000, 0}},
+#if RB_INTERVALS
+    {"intervals", rbBenchIntervals, {100000, 1000000, 0}},
+#endif
+};
+
+/*Run the benchmark named by argv[0], either at the sizes given in the remaining arguments or at its default sizes.
+Every measurement is printed as one JSON object per line*/
+int rbBenchMain(int argc, char *argv[]) {
+    int b, i, count = sizeof(rbBenches) / sizeof(rbBenches[0]);
+    for (b = 0; argc >= 1 && b < count; b++) {
+        if (strcmp(argv[0], rbBenches[b].name) == 0) {
+            if (argc >= 2) {
+                for (i = 1; i < argc; i++) {
+                    rbBenches[b].run(atoi(argv[i]));
+                }
+            } else {
+                for (i = 0; i < 4 && rbBenches[b].sizes[i] != 0; i++) {
+                    rbBenches[b].run(rbBenches[b].sizes[i]);
+                }
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "Usage: bench <name> [n ...] where name is one of:");
+    for (b = 0; b < count; b++) {
+        fprintf(stderr, " %s", rbBenches[b].name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+/*Return a monotonic timestamp in seconds*/
+double rbNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*Return the next value of a xorshift64* generator. Benchmarks use it instead of rand() for reproducible 64-bit output*/
+uint64_t rbRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/*Return a malloc'd array holding 0, stride, 2*stride, ... , (n-1)*stride in random order*/
+int *rbShuffledKeys(int n, int stride, uint64_t *state) {
+    int *keys = malloc(n * sizeof(int));
+    int i, j, tmp;
+    for (i = 0; i < n; i++) {
+        keys[i] = i * stride;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(rbRandom(state) % (uint64_t)(i + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+/*Compare lookups per second of a loop over rbIterativeTreeSearch against rbTreeSearchBatch on a tree of n keys built
+by random insertion. Probes are drawn uniformly from twice the key range, so about half of them miss*/
+void rbBenchSearch(int n) {
+    RBTree *rbTree;
+    RBTNode **results;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, hits;
+    double start, single, batch;
+
+    rbTree = rbTreeCreate();
+    keys = rbShuffledKeys(n, 2, &state);
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+    }
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    results = malloc(RB_BENCH_LOOKUPS * sizeof(RBTNode *));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)(2 * n));
+    }
+
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+    }
+    single = RB_BENCH_LOOKUPS / (rbNow() - start);
+    printf("{\"bench\":\"search\",\"tree\":\"rbt\",\"n\":%d,\"mode\":\"single\",\"lookups_per_sec\":%.0f,\"hits\":%d}\n",
+        n, single, hits);
+
+    start = rbNow();
+    rbTreeSearchBatch(rbTree, probes, RB_BENCH_LOOKUPS, results);
+    batch = RB_BENCH_LOOKUPS / (rbNow() - start);
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += results[i] != rbTree->nil;
+    }
+    printf("{\"bench\":\"search\",\"tree\":\"rbt\",\"n\":%d,\"mode\":\"batch\",\"lookups_per_sec\":%.0f,\"hits\":%d,\"speedup\":%.2f}\n",
+        n, batch, hits, batch / single);
+
+    free(keys);
+    free(probes);
+    free(results);
+    rbTreeDestroy(rbTree);
+    return;
+}
+
+/*Compare the pointer layout against the compact index layout on a tree of n keys inserted in random order. Reports
+the bytes allocated per stored key along with insert and lookup throughput*/
+void rbBenchCompact(int n) {
+    RBTree *rbTree;
+    RBCTree *tree;
+    RBTNodeSlab *slab;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, hits;
+    size_t bytes;
+    double start, inserts, lookups;
+
+    keys = rbShuffledKeys(n, 2, &state);
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)(2 * n));
+    }
+
+    rbTree = rbTreeCreate();
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+    }
+    inserts = n / (rbNow() - start);
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+    }
+    lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+    bytes = sizeof(RBTree) + sizeof(RBTNodePool);
+    for (slab = rbTree->pool->slabs; slab != NULL; slab = slab->next) {
+        bytes += sizeof(RBTNodeSlab) + slab->capacity * sizeof(RBTNode);
+    }
+    printf("{\"bench\":\"compact\",\"layout\":\"pointer\",\"n\":%d,\"node_bytes\":%d,\"bytes_per_key\":%.1f,"
+        "\"inserts_per_sec\":%.0f,\"lookups_per_sec\":%.0f,\"hits\":%d}\n",
+        n, (int)sizeof(RBTNode), (double)bytes / n, inserts, lookups, hits);
+    rbTreeDestroy(rbTree);
+
+    tree = rbcTreeCreate(0);
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        rbcTreeInsert(tree, keys[i]);
+    }
+    inserts = n / (rbNow() - start);
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbcIterativeTreeSearch(tree, probes[i]) != RBC_NIL;
+    }
+    lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+    bytes = sizeof(RBCTree) + tree->capacity * sizeof(RBCNode);
+    printf("{\"bench\":\"compact\",\"layout\":\"index\",\"n\":%d,\"node_bytes\":%d,\"bytes_per_key\":%.1f,"
+        "\"inserts_per_sec\":%.0f,\"lookups_per_sec\":%.0f,\"hits\":%d}\n",
+        n, (int)sizeof(RBCNode), (double)bytes / n, inserts, lookups, hits);
+    rbcTreeDestroy(tree);
+
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Compare lookups per second of rbIterativeTreeSearch against a frozen snapshot of the same tree, and count the probes
+on which the two disagree, which should always be zero*/
+void rbBenchSnapshot(int n) {
+    RBTree *rbTree;
+    RBSnapshot *snapshot;
+    uint64_t state = 88172645463325252ULL;
+    const int *first;
+    int *keys, *probes;
+    int i, hits, mismatches, lo, hi;
+    double start, tree, frozen, freeze;
+
+    rbTree = rbTreeCreate();
+    keys = rbShuffledKeys(n, 2, &state);
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+    }
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)(2 * n));
+    }
+    start = rbNow();
+    snapshot = rbTreeFreeze(rbTree);
+    freeze = rbNow() - start;
+
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+    }
+    tree = RB_BENCH_LOOKUPS / (rbNow() - start);
+    start = rbNow();
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits -= rbSnapshotSearch(snapshot, probes[i]);
+    }
+    frozen = RB_BENCH_LOOKUPS / (rbNow() - start);
+    mismatches = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS / 100; i++) {
+        mismatches += (rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil) !=
+            rbSnapshotSearch(snapshot, probes[i]);
+        //Exactly the even keys below 2n are stored, so the size of any range is known in advance
+        lo = probes[i] + probes[i] % 2;
+        hi = probes[i] + 19 < 2 * n - 2 ? probes[i] + 19 : 2 * n - 2;
+        mismatches += rbSnapshotRange(snapshot, probes[i], probes[i] + 19, &first) != (hi >= lo ? (hi - lo) / 2 + 1 : 0);
+    }
+    printf("{\"bench\":\"snapshot\",\"n\":%d,\"tree_lookups_per_sec\":%.0f,\"snapshot_lookups_per_sec\":%.0f,"
+        "\"speedup\":%.2f,\"freeze_sec\":%.3f,\"hit_difference\":%d,\"mismatches\":%d}\n",
+        n, tree, frozen, frozen / tree, freeze, hits, mismatches);
+
+    rbSnapshotDestroy(snapshot);
+    free(keys);
+    free(probes);
+    rbTreeDestroy(rbTree);
+    return;
+}
+
+/*Return a malloc'd stream of count keys drawn from n distinct keys, the k-th most popular with probability
+proportional to 1/k. The cumulative distribution is inverted with a binary search, then the ranks are scattered with a
+multiplicative hash so that popular keys are not also the smallest ones. Rank r maps to key rbBenchZipfKey(r)*/
+int *rbBenchZipf(int n, int count, uint64_t *state) {
+    int *keys = malloc(count * sizeof(int));
+    double *cdf, total, u;
+    int i, lo, hi, mid;
+    cdf = malloc(n * sizeof(double));
+    for (i = 0, total = 0; i < n; i++) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+    for (i = 0; i < count; i++) {
+        u = (rbRandom(state) >> 11) * (1.0 / 9007199254740992.0) * total;
+        for (lo = 0, hi = n - 1; lo < hi; ) {
+            mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        keys[i] = rbBenchZipfKey(lo);
+    }
+    free(cdf);
+    return keys;
+}
+
+/*Key of rank r in the streams of rbBenchZipf*/
+int rbBenchZipfKey(int r) {
+    return (int)(((uint32_t)r * 2654435761u) & INT_MAX);
+}
+
+/*Return a malloc'd stream of n keys following the named distribution: "sorted", "reverse", "uniform", "zipf" (n
+distinct keys with the k-th most popular drawn with probability proportional to 1/k) or "sawtooth" (interleaved
+ascending runs). Returns NULL for an unknown name*/
+int *rbBenchKeys(const char *dist, int n, uint64_t *state) {
+    int *keys = malloc(n * sizeof(int));
+    int i, teeth;
+    if (strcmp(dist, "sorted") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = i;
+        }
+    } else if (strcmp(dist, "reverse") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = n - 1 - i;
+        }
+    } else if (strcmp(dist, "uniform") == 0) {
+        for (i = 0; i < n; i++) {
+            keys[i] = (int)(rbRandom(state) % INT_MAX);
+        }
+    } else if (strcmp(dist, "zipf") == 0) {
+        free(keys);
+        return rbBenchZipf(n, n, state);
+    } else if (strcmp(dist, "sawtooth") == 0) {
+        //Key i lands in tooth i % teeth at height i / teeth, so consecutive keys climb different teeth in turn
+        for (teeth = 1; teeth * teeth < n; teeth++) {
+        }
+        for (i = 0; i < n; i++) {
+            keys[i] = (i % teeth) * ((n + teeth - 1) / teeth) + i / teeth;
+        }
+    } else {
+        free(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+/*Subroutine for rbQuantile*/
+int rbCompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*Return the q-quantile of count samples, sorting the samples in place*/
+double rbQuantile(double *samples, int count, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(samples, count, sizeof(double), rbCompareDoubles);
+    return samples[(int)(q * (count - 1))];
+}
+
+/*Print one line of suite results. elapsed covers all n operations while samples holds the latency of every
+RB_BENCH_SAMPLE_EVERY-th operation, so that reading the clock adds little to the average. max_depth is the height of
+the tree after all inserts and peak_rss_kb is the peak resident set of the process so far*/
+void rbBenchReport(const char *dist, int n, const char *op, double elapsed, double *samples, int count, int height) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"bench\":\"suite\",\"tree\":\"rbt\",\"dist\":\"%s\",\"n\":%d,\"op\":\"%s\",\"ns_per_op\":%.1f,"
+        "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"max_depth\":%d,\"peak_rss_kb\":%ld}\n",
+        dist, n, op, elapsed * 1e9 / n, rbQuantile(samples, count, 0.5) * 1e9, rbQuantile(samples, count, 0.99) * 1e9,
+        height, (long)usage.ru_maxrss);
+    return;
+}
+
+/*Run insert, search, traversal and delete over n keys from every distribution that rbBenchKeys knows. rbTreeCheck is
+run after the inserts and again halfway through the deletes, and any failure is reported on stderr*/
+void rbBenchSuite(int n) {
+    const char *dists[] = {"sorted", "reverse", "uniform", "zipf", "sawtooth"};
+    RBTree *rbTree;
+    RBTNode *node;
+    uint64_t state = 88172645463325252ULL;
+    double *samples, start, t = 0, elapsed, overhead;
+    int *keys;
+    int d, i, count, height;
+
+    samples = malloc((n / RB_BENCH_SAMPLE_EVERY + 1) * sizeof(double));
+    //The cheapest back-to-back clock reading is subtracted from every sample
+    for (i = 0, overhead = 1; i < 1000; i++) {
+        t = rbNow();
+        t = rbNow() - t;
+        overhead = t < overhead ? t : overhead;
+    }
+    for (d = 0; d < (int)(sizeof(dists) / sizeof(dists[0])); d++) {
+        keys = rbBenchKeys(dists[d], n, &state);
+        rbTree = rbTreeCreate();
+
+        count = 0;
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                t = rbNow();
+            }
+            rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = rbNow() - t - overhead;
+            }
+        }
+        elapsed = rbNow() - start;
+        height = rbTreeHeight(rbTree);
+        if (rbTreeCheck(rbTree) < 0) {
+            fprintf(stderr, "suite: %s tree is not a valid red-black tree after the inserts\n", dists[d]);
+        }
+        rbBenchReport(dists[d], n, "insert", elapsed, samples, count, height);
+
+        count = 0;
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                t = rbNow();
+            }
+            node = rbIterativeTreeSearch(rbTree, rbTree->root, keys[i]);
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = rbNow() - t - overhead;
+            }
+            if (node == rbTree->nil) {
+                fprintf(stderr, "suite: key %d went missing\n", keys[i]);
+            }
+        }
+        elapsed = rbNow() - start;
+        rbBenchReport(dists[d], n, "search", elapsed, samples, count, height);
+
+        //The whole walk is a single operation, so its only sample is the average cost per key
+        count = 0;
+        start = rbNow();
+        for (node = rbTreeMin(rbTree, rbTree->root); node != rbTree->nil; node = rbTreeSuccessor(rbTree, node)) {
+            count++;
+        }
+        elapsed = rbNow() - start;
+        if (count != n) {
+            fprintf(stderr, "suite: walked %d of %d keys\n", count, n);
+        }
+        samples[0] = elapsed / n;
+        rbBenchReport(dists[d], n, "traverse", elapsed, samples, 1, height);
+
+        count = 0;
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (i == n / 2) {
+                //Check the tree halfway through the deletes, leaving the time of the check out of the measurement
+                t = rbNow();
+                if (rbTreeCheck(rbTree) < 0) {
+                    fprintf(stderr, "suite: %s tree is not a valid red-black tree after %d deletes\n", dists[d], i);
+                }
+                start += rbNow() - t;
+            }
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                t = rbNow();
+            }
+            node = rbIterativeTreeSearch(rbTree, rbTree->root, keys[i]);
+            treeDelete(rbTree, node);
+            rbNodeFree(rbTree, node);
+            if (i % RB_BENCH_SAMPLE_EVERY == 0) {
+                samples[count++] = rbNow() - t - overhead;
+            }
+        }
+        elapsed = rbNow() - start;
+        rbBenchReport(dists[d], n, "delete", elapsed, samples, count, height);
+
+        rbTreeDestroy(rbTree);
+        free(keys);
+    }
+    free(samples);
+    return;
+}
+
+/*Time union, intersection and difference of two trees of n keys each, the even numbers and the multiples of three, at
+1, 2, 4, ... threads up to the number of online cores. Speedup is relative to running on the calling thread without a
+pool. Union is also timed against inserting the second tree into the first key by key*/
+void rbBenchSetOps(int n) {
+    static const char ops[] = "uid";
+    static const char *names[] = {"union", "intersection", "difference"};
+    RBTree *rbTree, *other;
+    RBThreadPool *threads;
+    int *keys;
+    int o, t, i, cores, count, height, expected[3];
+    double start, elapsed, sequential = 0;
+
+    cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+    keys = malloc(n * sizeof(int));
+    expected[1] = (2 * n + 5) / 6; //Multiples of six below 2n
+    expected[0] = 2 * n - expected[1];
+    expected[2] = n - expected[1];
+    rbTree = rbTreeCreate();
+    other = rbTreeCreateShared(rbTree);
+
+    rbBenchSetInputs(rbTree, other, keys, n);
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        //Skip keys already present to get the same set the union produces
+        if (rbIterativeTreeSearch(rbTree, rbTree->root, i * 3) == rbTree->nil) {
+            rbTreeInsert(rbTree, rbNodeAlloc(rbTree, i * 3));
+        }
+    }
+    elapsed = rbNow() - start;
+    printf("{\"bench\":\"setops\",\"op\":\"union\",\"method\":\"insert\",\"n\":%d,\"threads\":1,\"seconds\":%.6f}\n",
+        n, elapsed);
+
+    for (o = 0; o < 3; o++) {
+        for (t = 0; t <= cores; t = t == 0 ? 1 : 2 * t) {
+            threads = t == 0 ? NULL : rbThreadPoolCreate(t);
+            rbBenchSetInputs(rbTree, other, keys, n);
+            start = rbNow();
+            rbSetOperation(rbTree, other, ops[o], threads);
+            elapsed = rbNow() - start;
+            if (t == 0) {
+                sequential = elapsed;
+            }
+            count = 0;
+            if (rbSubtreeCheck(rbTree, rbTree->root, INT_MIN, INT_MAX, &count, &height) < 0 ||
+                count != expected[o]) {
+                fprintf(stderr, "setops: %s produced %d keys, expected %d\n", names[o], count, expected[o]);
+            }
+            printf("{\"bench\":\"setops\",\"op\":\"%s\",\"method\":\"%s\",\"n\":%d,\"threads\":%d,\"seconds\":%.6f,"
+                "\"speedup\":%.2f,\"result\":%d}\n", names[o], t == 0 ? "sequential" : "parallel", n, t == 0 ? 1 : t,
+                elapsed, sequential / elapsed, count);
+            if (threads != NULL) {
+                rbThreadPoolDestroy(threads);
+            }
+        }
+    }
+    rbTreeDestroy(other);
+    rbTreeDestroy(rbTree);
+    free(keys);
+    return;
+}
+
+/*Rebuild rbTree with the n even numbers from 0 and other with the n multiples of three from 0, using keys as scratch*/
+void rbBenchSetInputs(RBTree *rbTree, RBTree *other, int *keys, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        keys[i] = i * 2;
+    }
+    rbTreeBuildSorted(rbTree, keys, n, 0);
+    for (i = 0; i < n; i++) {
+        keys[i] = i * 3;
+    }
+    rbTreeBuildSorted(other, keys, n, 0);
+    return;
+}
+
+/*Measure lookup throughput at 1, 2, 4, ... reader threads up to the number of online cores while one writer thread keeps
+deleting and reinserting keys, once for the concurrent tree and once for an RBTree behind a global mutex. The tree
+holds the n even numbers below 2n, and lookups probe uniformly below 2n*/
+void rbBenchRcu(int n) {
+    static const char *modes[] = {"rcu", "mutex"};
+    RBBenchThread *args;
+    pthread_t *ids;
+    pthread_mutex_t lock;
+    atomic_int stop;
+    RBRcuTree *rcu;
+    RBTree *rbTree;
+    struct timespec pause;
+    long reads;
+    int m, r, i, cores;
+    int *keys;
+    uint64_t state = 88172645463325252ULL;
+
+    cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+    args = malloc((cores + 1) * sizeof(RBBenchThread));
+    ids = malloc((cores + 1) * sizeof(pthread_t));
+    pthread_mutex_init(&lock, NULL);
+    pause.tv_sec = (time_t)RB_BENCH_SECONDS;
+    pause.tv_nsec = (long)((RB_BENCH_SECONDS - pause.tv_sec) * 1e9);
+    keys = rbShuffledKeys(n, 2, &state);
+    for (m = 0; m < 2; m++) {
+        for (r = 1; r <= cores; r *= 2) {
+            rcu = NULL;
+            rbTree = NULL;
+            if (m == 0) {
+                rcu = rbRcuTreeCreate();
+                for (i = 0; i < n; i++) {
+                    rbRcuInsert(rcu, keys[i]);
+                }
+            } else {
+                rbTree = rbTreeCreate();
+                for (i = 0; i < n; i++) {
+                    rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+                }
+            }
+            atomic_init(&stop, 0);
+            //args[0] is the writer, the rest are readers
+            for (i = 0; i <= r; i++) {
+                args[i].rcu = rcu;
+                args[i].topDown = NULL;
+                args[i].rbTree = rbTree;
+                args[i].lock = &lock;
+                args[i].stop = &stop;
+                args[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+                args[i].n = n;
+                args[i].ops = args[i].hits = 0;
+                pthread_create(&(ids[i]), NULL, i == 0 ? rbBenchRcuWriter : rbBenchRcuReader, &(args[i]));
+            }
+            nanosleep(&pause, NULL);
+            atomic_store(&stop, 1);
+            reads = 0;
+            for (i = 0; i <= r; i++) {
+                pthread_join(ids[i], NULL);
+                reads += i == 0 ? 0 : args[i].ops;
+            }
+            printf("{\"bench\":\"rcu\",\"mode\":\"%s\",\"n\":%d,\"readers\":%d,\"reads_per_sec\":%.0f,"
+                "\"writes_per_sec\":%.0f}\n", modes[m], n, r, reads / RB_BENCH_SECONDS,
+                args[0].ops / RB_BENCH_SECONDS);
+            if (rcu != NULL) {
+                rbRcuTreeDestroy(rcu);
+            } else {
+                rbTreeDestroy(rbTree);
+            }
+        }
+    }
+    pthread_mutex_destroy(&lock);
+    free(keys);
+    free(args);
+    free(ids);
+    return;
+}
+
+/*Reader thread of rbBenchRcu: look up random keys until told to stop*/
+void *rbBenchRcuReader(void *arg) {
+    RBBenchThread *thread = arg;
+    RBRcuReader *reader = NULL;
+    int key;
+    if (thread->rcu != NULL) {
+        reader = rbRcuRegister(thread->rcu);
+    }
+    while (!atomic_load_explicit(thread->stop, memory_order_relaxed)) {
+        key = (int)(rbRandom(&(thread->seed)) % (uint64_t)(2 * thread->n));
+        if (reader != NULL) {
+            thread->hits += rbRcuSearch(reader, key);
+        } else {
+            pthread_mutex_lock(thread->lock);
+            thread->hits += rbIterativeTreeSearch(thread->rbTree, thread->rbTree->root, key) != thread->rbTree->nil;
+            pthread_mutex_unlock(thread->lock);
+        }
+        thread->ops++;
+    }
+    if (reader != NULL) {
+        rbRcuUnregister(reader);
+    }
+    return NULL;
+}
+
+/*Writer thread of rbBenchRcu: delete a random key of the tree and insert it again until told to stop. Each counts as
+one write*/
+void *rbBenchRcuWriter(void *arg) {
+    RBBenchThread *thread = arg;
+    RBTNode *node;
+    int key;
+    while (!atomic_load_explicit(thread->stop, memory_order_relaxed)) {
+        key = (int)(rbRandom(&(thread->seed)) % (uint64_t)thread->n) * 2;
+        if (thread->rcu != NULL) {
+            rbRcuDelete(thread->rcu, key);
+            rbRcuInsert(thread->rcu, key);
+        } else {
+            pthread_mutex_lock(thread->lock);
+            node = rbIterativeTreeSearch(thread->rbTree, thread->rbTree->root, key);
+            treeDelete(thread->rbTree, node);
+            rbNodeFree(thread->rbTree, node);
+            rbTreeInsert(thread->rbTree, rbNodeAlloc(thread->rbTree, key));
+            pthread_mutex_unlock(thread->lock);
+        }
+        thread->ops += 2;
+    }
+    return NULL;
+}
+
+/*Insert n shuffled keys into a persistent tree, keeping every intermediate version alive, and report the nodes each
+update added. Then run point-in-time lookups against randomly chosen versions, and delete every key again from the
+last version*/
+void rbBenchVersions(int n) {
+    RBPStore *store;
+    RBVersion **versions;
+    uint64_t state = 88172645463325252ULL;
+    int *keys;
+    int i, v, hits, expected;
+    double start, inserts, lookups, deletes;
+    long peak;
+
+    store = rbPStoreCreate();
+    keys = rbShuffledKeys(n, 1, &state);
+    versions = malloc((n + 1) * sizeof(RBVersion *));
+    versions[0] = rbVersionCreate(store);
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        versions[i + 1] = rbVersionInsert(versions[i], keys[i]);
+    }
+    inserts = n / (rbNow() - start);
+    peak = store->live;
+
+    //Version v holds exactly the first v keys, so a probe for keys[i] hits iff i < v
+    hits = expected = 0;
+    start = rbNow();
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        v = (int)(rbRandom(&state) % (uint64_t)(n + 1));
+        hits += rbVersionSearch(versions[v], keys[i % n]);
+        expected += i % n < v;
+    }
+    lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+    if (hits != expected) {
+        fprintf(stderr, "versions: %d hits, expected %d\n", hits, expected);
+    }
+
+    for (i = 0; i < n; i++) {
+        rbVersionRelease(versions[i]);
+    }
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        versions[0] = rbVersionDelete(versions[n], keys[i]);
+        rbVersionRelease(versions[n]);
+        versions[n] = versions[0];
+    }
+    deletes = n / (rbNow() - start);
+    printf("{\"bench\":\"versions\",\"n\":%d,\"versions\":%d,\"nodes\":%ld,\"nodes_per_update\":%.1f,"
+        "\"bytes_per_update\":%.1f,\"inserts_per_sec\":%.0f,\"lookups_per_sec\":%.0f,\"deletes_per_sec\":%.0f,"
+        "\"nodes_left\":%ld}\n", n, n + 1, peak, (double)peak / n, (double)peak * sizeof(RBPNode) / n, inserts, lookups,
+        deletes, store->live);
+    rbVersionRelease(versions[n]);
+    rbPStoreDestroy(store);
+    free(versions);
+    free(keys);
+    return;
+}
+
+/*Compare starting up from a tree image against replaying every key through rbTreeInsert. Reports the time to write
+the image, to map it with and without checking the checksum, and the lookups per second of the mapped tree, then
+thaws the image and inserts into it. Mismatches between the mapped tree and the original are counted and should be
+zero*/
+void rbBenchImage(int n) {
+    RBTree *rbTree;
+    RBImage *image;
+    RBCTree *tree;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, mismatches = 0, hits = 0, expected = 0;
+    double start, replay, write, open, verify, first, lookups;
+
+    keys = rbShuffledKeys(n, 2, &state);
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)(2 * n));
+    }
+    rbTree = rbTreeCreate();
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+    }
+    replay = rbNow() - start;
+    start = rbNow();
+    if (!rbTreeWriteImage(rbTree, RB_BENCH_IMAGE)) {
+        fprintf(stderr, "image: cannot write %s\n", RB_BENCH_IMAGE);
+        rbTreeDestroy(rbTree);
+        free(keys);
+        free(probes);
+        return;
+    }
+    write = rbNow() - start;
+
+    start = rbNow();
+    image = rbImageOpen(RB_BENCH_IMAGE, 1);
+    verify = rbNow() - start;
+    if (image != NULL) {
+        rbImageClose(image);
+        start = rbNow();
+        image = rbImageOpen(RB_BENCH_IMAGE, 0);
+        open = rbNow() - start;
+    }
+    if (image == NULL) {
+        remove(RB_BENCH_IMAGE);
+        rbTreeDestroy(rbTree);
+        free(keys);
+        free(probes);
+        return;
+    }
+    start = rbNow();
+    mismatches += (rbcIterativeTreeSearch(&(image->view), probes[0]) != RBC_NIL) != (probes[0] % 2 == 0);
+    first = rbNow() - start;
+    start = rbNow();
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbcIterativeTreeSearch(&(image->view), probes[i]) != RBC_NIL;
+    }
+    lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+    //Compare against the pointer tree outside the timed loop
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        expected += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+        mismatches += (rbcIterativeTreeSearch(&(image->view), probes[i]) != RBC_NIL) !=
+            (rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil);
+    }
+    mismatches += hits != expected;
+    if (image->header->count != (uint32_t)n || (int)image->header->height != rbTreeHeight(rbTree)) {
+        mismatches++;
+    }
+
+    //Thaw and fill in the odd keys, half of them in the room left by the thaw and the rest after moving to the heap
+    if ((tree = rbImageThaw(image, n / 4)) == NULL) {
+        fprintf(stderr, "image: cannot thaw %s\n", RB_BENCH_IMAGE);
+        rbImageClose(image);
+        remove(RB_BENCH_IMAGE);
+        rbTreeDestroy(rbTree);
+        free(keys);
+        free(probes);
+        return;
+    }
+    for (i = 0; i < n; i += 2) {
+        rbcTreeInsert(tree, 2 * i + 1);
+    }
+    for (i = 0; i < n; i += 2) {
+        mismatches += rbcIterativeTreeSearch(tree, 2 * i + 1) == RBC_NIL || rbcIterativeTreeSearch(tree, 2 * i) == RBC_NIL;
+    }
+    printf("{\"bench\":\"image\",\"n\":%d,\"file_bytes\":%lu,\"replay_sec\":%.6f,\"write_sec\":%.6f,\"open_sec\":%.6f,"
+        "\"open_verified_sec\":%.6f,\"first_lookup_sec\":%.6f,\"lookups_per_sec\":%.0f,\"mismatches\":%d}\n", n,
+        (unsigned long)(sizeof(RBImageHeader) + (n + 1) * sizeof(RBCNode)), replay, write, open, verify, first, lookups,
+        mismatches);
+    rbcTreeDestroy(tree);
+    remove(RB_BENCH_IMAGE);
+    rbTreeDestroy(rbTree);
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Compare lookups in the generated int32 tree against rbIterativeTreeSearch on the same keys and probes, and time the
+other generated instances on the same workload. The ratio should stay close to 1*/
+void rbBenchTyped(int n) {
+    RBTree *rbTree;
+    RBInt32Map *int32Map;
+    RBInt64Map *int64Map;
+    RBUInt64Map *uint64Map;
+    RBBytesMap *bytesMap;
+    RBBytesKey bytesKey;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, round, hits;
+    double start, elapsed, generic = 0, typed = 0;
+
+    rbTree = rbTreeCreate();
+    int32Map = rbInt32MapCreate();
+    int64Map = rbInt64MapCreate();
+    uint64Map = rbUInt64MapCreate();
+    bytesMap = rbBytesMapCreate();
+    memset(&bytesKey, 0, sizeof(RBBytesKey));
+    keys = rbShuffledKeys(n, 2, &state);
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+        rbInt32MapPut(int32Map, keys[i], i);
+        rbInt64MapPut(int64Map, keys[i], i);
+        rbUInt64MapPut(uint64Map, (uint64_t)keys[i], (uint64_t)i);
+        //Big-endian so that memcmp order agrees with the integer order
+        bytesKey.bytes[12] = (unsigned char)(keys[i] >> 24);
+        bytesKey.bytes[13] = (unsigned char)(keys[i] >> 16);
+        bytesKey.bytes[14] = (unsigned char)(keys[i] >> 8);
+        bytesKey.bytes[15] = (unsigned char)keys[i];
+        rbBytesMapPut(bytesMap, bytesKey, (uint64_t)i);
+    }
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)(2 * n));
+    }
+
+    //Alternate the two runs a few times and keep the best of each, so that neither one is favored by a warm cache
+    for (round = 0; round < 3; round++) {
+        start = rbNow();
+        hits = 0;
+        for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+            hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+        }
+        elapsed = rbNow() - start;
+        generic = RB_BENCH_LOOKUPS / elapsed > generic ? RB_BENCH_LOOKUPS / elapsed : generic;
+
+        start = rbNow();
+        hits = 0;
+        for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+            hits += rbInt32MapSearch(int32Map, probes[i]) != NULL;
+        }
+        elapsed = rbNow() - start;
+        typed = RB_BENCH_LOOKUPS / elapsed > typed ? RB_BENCH_LOOKUPS / elapsed : typed;
+    }
+    printf("{\"bench\":\"typed\",\"tree\":\"rbt\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d}\n", n, generic, hits);
+    printf("{\"bench\":\"typed\",\"tree\":\"int32\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, typed, hits, typed / generic);
+
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbInt64MapSearch(int64Map, probes[i]) != NULL;
+    }
+    elapsed = rbNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"int64\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, RB_BENCH_LOOKUPS / elapsed, hits, RB_BENCH_LOOKUPS / elapsed / generic);
+
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbUInt64MapSearch(uint64Map, (uint64_t)probes[i]) != NULL;
+    }
+    elapsed = rbNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"uint64\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, RB_BENCH_LOOKUPS / elapsed, hits, RB_BENCH_LOOKUPS / elapsed / generic);
+
+    start = rbNow();
+    hits = 0;
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        bytesKey.bytes[12] = (unsigned char)(probes[i] >> 24);
+        bytesKey.bytes[13] = (unsigned char)(probes[i] >> 16);
+        bytesKey.bytes[14] = (unsigned char)(probes[i] >> 8);
+        bytesKey.bytes[15] = (unsigned char)probes[i];
+        hits += rbBytesMapSearch(bytesMap, bytesKey) != NULL;
+    }
+    elapsed = rbNow() - start;
+    printf("{\"bench\":\"typed\",\"tree\":\"bytes16\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"ratio\":%.2f}\n",
+        n, RB_BENCH_LOOKUPS / elapsed, hits, RB_BENCH_LOOKUPS / elapsed / generic);
+
+    free(keys);
+    free(probes);
+    rbTreeDestroy(rbTree);
+    rbInt32MapDestroy(int32Map);
+    rbInt64MapDestroy(int64Map);
+    rbUInt64MapDestroy(uint64Map);
+    rbBytesMapDestroy(bytesMap);
+    return;
+}
+
+/*Zipf-distributed lookups over n keys, the same workload with the same seed as "bench skewed" of BinarySearchTrees,
+so the red-black tree can be compared against the splay modes there*/
+void rbBenchSkewed(int n) {
+    RBTree *rbTree;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, j, tmp, hits;
+    double start, elapsed;
+
+    keys = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        keys[i] = rbBenchZipfKey(i);
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(rbRandom(&state) % (uint64_t)(i + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    probes = rbBenchZipf(n, RB_BENCH_LOOKUPS, &state);
+    rbTree = rbTreeCreate();
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+    }
+    hits = 0;
+    start = rbNow();
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+    }
+    elapsed = rbNow() - start;
+    printf("{\"bench\":\"skewed\",\"tree\":\"rbt\",\"n\":%d,\"lookups_per_sec\":%.0f,\"hits\":%d,\"height\":%d}\n",
+        n, RB_BENCH_LOOKUPS / elapsed, hits, rbTreeHeight(rbTree));
+    rbTreeDestroy(rbTree);
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Insert a stream of n Zipf-distributed keys drawn from n / 100 distinct keys, once into a tree of duplicate nodes and
+once into a multiset, then empty both one copy at a time. Reports the time of each phase along with the number of
+nodes and the height the stream left behind*/
+void rbBenchMultiset(int n) {
+    const char *names[] = {"duplicates", "multiset"};
+    RBTree *rbTree;
+    RBIterator iterator;
+    RBTNode *node;
+    uint64_t state = 88172645463325252ULL;
+    int *keys;
+    int i, multiset, nodes, height, key;
+    double start, insert, delete;
+
+    keys = rbBenchZipf(n / 100 > 0 ? n / 100 : 1, n, &state);
+    for (multiset = 0; multiset <= 1; multiset++) {
+        rbTree = rbTreeCreate();
+        rbTree->multiset = multiset;
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (multiset) {
+                rbMultisetAdd(rbTree, keys[i]);
+            } else {
+                rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+            }
+        }
+        insert = rbNow() - start;
+        height = rbTreeHeight(rbTree);
+        rbIteratorInit(rbTree, &iterator);
+        for (nodes = 0; rbIteratorNext(&iterator, &key); nodes++) {
+        }
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (multiset) {
+                rbMultisetRemove(rbTree, keys[i], 1);
+            } else {
+                node = rbIterativeTreeSearch(rbTree, rbTree->root, keys[i]);
+                treeDelete(rbTree, node);
+                rbNodeFree(rbTree, node);
+            }
+        }
+        delete = rbNow() - start;
+        printf("{\"bench\":\"multiset\",\"mode\":\"%s\",\"n\":%d,\"inserts_per_sec\":%.0f,\"deletes_per_sec\":%.0f,"
+            "\"nodes\":%d,\"height\":%d}\n", names[multiset], n, n / insert, n / delete, nodes, height);
+        rbTreeDestroy(rbTree);
+    }
+    free(keys);
+    return;
+}
+
+/*Zipf-distributed lookups over n keys with and without a hot-key cache of RB_CACHE_SETS sets. The lookup phase only
+searches. The churn phase deletes and reinserts the probed key after every RB_BENCH_CHURN_EVERY lookups, so the hottest
+entries are the ones invalidated, and reports the cost of the cache when its contents keep going stale*/
+void rbBenchHotCache(int n) {
+    const char *phases[] = {"lookup", "churn"};
+    RBTree *rbTree;
+    RBTNode *node;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, j, tmp, hits, churn, cached;
+    double start, rate[2];
+
+    keys = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        keys[i] = rbBenchZipfKey(i);
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = (int)(rbRandom(&state) % (uint64_t)(i + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    probes = rbBenchZipf(n, RB_BENCH_LOOKUPS, &state);
+    for (churn = 0; churn <= 1; churn++) {
+        rbTree = rbTreeCreate();
+        for (i = 0; i < n; i++) {
+            rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+        }
+        for (cached = 0; cached <= 1; cached++) {
+            rbCacheEnable(rbTree, cached ? RB_CACHE_SETS : 0);
+            hits = 0;
+            start = rbNow();
+            for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+                node = rbCachedSearch(rbTree, probes[i]);
+                hits += node != rbTree->nil;
+                if (churn && i % RB_BENCH_CHURN_EVERY == 0) {
+                    treeDelete(rbTree, node);
+                    rbNodeFree(rbTree, node);
+                    rbTreeInsert(rbTree, rbNodeAlloc(rbTree, probes[i]));
+                }
+            }
+            rate[cached] = RB_BENCH_LOOKUPS / (rbNow() - start);
+            if (hits != RB_BENCH_LOOKUPS) {
+                fprintf(stderr, "hotcache: %d of %d lookups found their key\n", hits, RB_BENCH_LOOKUPS);
+            }
+        }
+        printf("{\"bench\":\"hotcache\",\"phase\":\"%s\",\"n\":%d,\"sets\":%d,\"plain_per_sec\":%.0f,"
+            "\"cached_per_sec\":%.0f,\"speedup\":%.2f,\"hit_rate\":%.3f,\"invalidations\":%llu}\n", phases[churn], n,
+            rbTree->cache->size, rate[0], rate[1], rate[1] / rate[0],
+            (double)rbTree->cache->hits / (rbTree->cache->hits + rbTree->cache->misses),
+            (unsigned long long)rbTree->cache->invalidations);
+        rbTreeDestroy(rbTree);
+    }
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Insert n ascending keys with rbInsertSortedBatch and with n independent rbTreeInserts, once into an empty tree and
+once into a tree already holding n shuffled even keys, with the batch made of the odd keys in between. Then search
+every even key in ascending order with a finger and from the root*/
+void rbBenchFinger(int n) {
+    const char *phases[] = {"ascending", "interleaved"};
+    RBTree *rbTree;
+    RBFinger finger;
+    uint64_t state = 88172645463325252ULL;
+    int *even, *batch;
+    int i, phase, fingered, hits;
+    double start, rate[2];
+
+    even = rbShuffledKeys(n, 2, &state);
+    batch = malloc(n * sizeof(int));
+    for (phase = 0; phase <= 1; phase++) {
+        for (i = 0; i < n; i++) {
+            batch[i] = phase ? 2 * i + 1 : i;
+        }
+        for (fingered = 0; fingered <= 1; fingered++) {
+            rbTree = rbTreeCreate();
+            for (i = 0; phase && i < n; i++) {
+                rbTreeInsert(rbTree, rbNodeAlloc(rbTree, even[i]));
+            }
+            start = rbNow();
+            if (fingered) {
+                rbInsertSortedBatch(rbTree, batch, n);
+            } else {
+                for (i = 0; i < n; i++) {
+                    rbTreeInsert(rbTree, rbNodeAlloc(rbTree, batch[i]));
+                }
+            }
+            rate[fingered] = n / (rbNow() - start);
+            if (rbTreeCheck(rbTree) < 0) {
+                fprintf(stderr, "finger: %s insertion broke the tree\n", fingered ? "batch" : "independent");
+            }
+            rbTreeDestroy(rbTree);
+        }
+        printf("{\"bench\":\"finger\",\"phase\":\"%s\",\"n\":%d,\"independent_per_sec\":%.0f,"
+            "\"batch_per_sec\":%.0f,\"speedup\":%.2f}\n", phases[phase], n, rate[0], rate[1], rate[1] / rate[0]);
+    }
+
+    rbTree = rbTreeCreate();
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, even[i]));
+    }
+    for (fingered = 0; fingered <= 1; fingered++) {
+        rbFingerInit(rbTree, &finger);
+        hits = 0;
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            if (fingered) {
+                hits += rbFingerSearch(&finger, 2 * i) != rbTree->nil;
+            } else {
+                hits += rbIterativeTreeSearch(rbTree, rbTree->root, 2 * i) != rbTree->nil;
+            }
+        }
+        rate[fingered] = n / (rbNow() - start);
+    }
+    printf("{\"bench\":\"finger\",\"phase\":\"search\",\"n\":%d,\"root_per_sec\":%.0f,\"finger_per_sec\":%.0f,"
+        "\"speedup\":%.2f,\"hits\":%d}\n", n, rate[0], rate[1], rate[1] / rate[0], hits);
+    rbTreeDestroy(rbTree);
+    free(even);
+    free(batch);
+    return;
+}
+
+/*Ingest n shuffled keys, deleting an earlier key after every RB_BENCH_DELETE_EVERY inserts, once straight into a tree
+and once through buffered trees of increasing capacity. Then time uniform lookups without merging what is still
+buffered, and report how many structures and index slots an average lookup had to check*/
+void rbBenchBuffered(int n) {
+    int capacities[] = {1024, 16384, 262144};
+    RBTree *rbTree;
+    RBBufferedTree *buffered;
+    RBIterator iterator;
+    RBTNode *node;
+    uint64_t state = 88172645463325252ULL;
+    int *keys, *probes;
+    int i, c, hits, size, key;
+    double start, ingest, lookups;
+
+    keys = rbShuffledKeys(n, 1, &state);
+    probes = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        probes[i] = (int)(rbRandom(&state) % (uint64_t)n);
+    }
+
+    rbTree = rbTreeCreate();
+    start = rbNow();
+    for (i = 0; i < n; i++) {
+        rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+        if (i % RB_BENCH_DELETE_EVERY == 0) {
+            node = rbIterativeTreeSearch(rbTree, rbTree->root, keys[i / 2]);
+            if (node != rbTree->nil) {
+                treeDelete(rbTree, node);
+                rbNodeFree(rbTree, node);
+            }
+        }
+    }
+    ingest = n / (rbNow() - start);
+    start = rbNow();
+    for (i = 0, hits = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIterativeTreeSearch(rbTree, rbTree->root, probes[i]) != rbTree->nil;
+    }
+    lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+    rbIteratorInit(rbTree, &iterator);
+    for (size = 0; rbIteratorNext(&iterator, &key); size++) {
+    }
+    printf("{\"bench\":\"buffered\",\"mode\":\"direct\",\"n\":%d,\"ingest_per_sec\":%.0f,\"lookups_per_sec\":%.0f,"
+        "\"structures_per_lookup\":1.00,\"slots_per_lookup\":0.00,\"hits\":%d}\n", n, ingest, lookups, hits);
+    rbTreeDestroy(rbTree);
+
+    for (c = 0; c < (int)(sizeof(capacities) / sizeof(capacities[0])); c++) {
+        buffered = rbBufferedCreate(capacities[c]);
+        start = rbNow();
+        for (i = 0; i < n; i++) {
+            rbBufferedInsert(buffered, keys[i]);
+            if (i % RB_BENCH_DELETE_EVERY == 0) {
+                rbBufferedDelete(buffered, keys[i / 2]);
+            }
+        }
+        ingest = n / (rbNow() - start);
+        start = rbNow();
+        for (i = 0, hits = 0; i < RB_BENCH_LOOKUPS; i++) {
+            hits += rbBufferedSearch(buffered, probes[i]);
+        }
+        lookups = RB_BENCH_LOOKUPS / (rbNow() - start);
+        printf("{\"bench\":\"buffered\",\"mode\":\"buffer\",\"capacity\":%d,\"n\":%d,\"ingest_per_sec\":%.0f,"
+            "\"lookups_per_sec\":%.0f,\"structures_per_lookup\":%.2f,\"slots_per_lookup\":%.2f,\"hits\":%d,"
+            "\"merges\":%llu}\n", capacities[c], n, ingest, lookups,
+            1 + (double)buffered->treeSearches / buffered->lookups, (double)buffered->probes / buffered->lookups, hits,
+            (unsigned long long)buffered->merges);
+        rbBufferedMerge(buffered);
+        if (buffered->size != size) {
+            fprintf(stderr, "buffered: %d keys after the merge, %d expected\n", buffered->size, size);
+        }
+        rbBufferedDestroy(buffered);
+    }
+    free(keys);
+    free(probes);
+    return;
+}
+
+/*Measure write throughput at 1, 2, 4, ... writer threads, up to the number of online cores but at least 4, of a
+concurrent top-down tree, of a top-down tree behind a global mutex and of an RBTree behind a global mutex. The trees
+start with the n even numbers below 2n, and each writer inserts or deletes, with equal odds, keys drawn uniformly below
+2n, so the size stays near n. Once the writers are joined the tree is checked, and its number of keys is compared with
+n plus the net change the writers counted. Failures are reported on stderr*/
+void rbBenchTopDown(int n) {
+    static const char *modes[] = {"topdown", "topdown-global", "mutex"};
+    RBBenchThread *args;
+    pthread_t *ids;
+    pthread_mutex_t lock;
+    atomic_int stop;
+    RBTDTree *topDown;
+    RBTree *rbTree;
+    struct timespec pause;
+    RBIterator iterator;
+    long writes, expected;
+    int m, w, i, cores, count, key, valid;
+    int *keys;
+    uint64_t state = 88172645463325252ULL;
+
+    cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 4) {
+        cores = 4;
+    }
+    args = malloc(cores * sizeof(RBBenchThread));
+    ids = malloc(cores * sizeof(pthread_t));
+    pthread_mutex_init(&lock, NULL);
+    pause.tv_sec = (time_t)RB_BENCH_SECONDS;
+    pause.tv_nsec = (long)((RB_BENCH_SECONDS - pause.tv_sec) * 1e9);
+    keys = rbShuffledKeys(n, 2, &state);
+    for (m = 0; m < 3; m++) {
+        for (w = 1; w <= cores; w *= 2) {
+            topDown = NULL;
+            rbTree = NULL;
+            if (m < 2) {
+                topDown = rbtdTreeCreate(m == 0);
+                for (i = 0; i < n; i++) {
+                    rbtdInsert(topDown, keys[i]);
+                }
+            } else {
+                rbTree = rbTreeCreate();
+                for (i = 0; i < n; i++) {
+                    rbTreeInsert(rbTree, rbNodeAlloc(rbTree, keys[i]));
+                }
+            }
+            atomic_init(&stop, 0);
+            for (i = 0; i < w; i++) {
+                args[i].rcu = NULL;
+                args[i].topDown = topDown;
+                args[i].rbTree = rbTree;
+                args[i].lock = m == 0 ? NULL : &lock;
+                args[i].stop = &stop;
+                args[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+                args[i].n = n;
+                args[i].ops = args[i].hits = 0;
+                pthread_create(&(ids[i]), NULL, rbBenchTopDownWriter, &(args[i]));
+            }
+            nanosleep(&pause, NULL);
+            atomic_store(&stop, 1);
+            writes = 0;
+            expected = n;
+            for (i = 0; i < w; i++) {
+                pthread_join(ids[i], NULL);
+                writes += args[i].ops;
+                expected += args[i].hits;
+            }
+            if (topDown != NULL) {
+                valid = rbtdCheck(topDown, &count) >= 0;
+            } else {
+                valid = rbTreeCheck(rbTree) >= 0;
+                rbIteratorInit(rbTree, &iterator);
+                for (count = 0; rbIteratorNext(&iterator, &key); count++) {
+                }
+            }
+            if (!valid) {
+                fprintf(stderr, "topdown: %s tree is not a valid red-black tree after %d writers\n", modes[m], w);
+            }
+            if (count != expected) {
+                fprintf(stderr, "topdown: %s tree holds %d keys, expected %ld\n", modes[m], count, expected);
+            }
+            printf("{\"bench\":\"topdown\",\"mode\":\"%s\",\"n\":%d,\"writers\":%d,\"writes_per_sec\":%.0f,"
+                "\"node_bytes\":%zu}\n", modes[m], n, w, writes / RB_BENCH_SECONDS,
+                m < 2 ? sizeof(RBTDNode) : sizeof(RBTNode));
+            if (topDown != NULL) {
+                rbtdTreeDestroy(topDown);
+            } else {
+                rbTreeDestroy(rbTree);
+            }
+        }
+    }
+    pthread_mutex_destroy(&lock);
+    free(keys);
+    free(args);
+    free(ids);
+    return;
+}
+
+/*Writer thread of rbBenchTopDown: insert or delete random keys until told to stop. Each call counts as one write,
+whether or not it changed the tree. hits tracks the net change in the number of keys, so the final size can be
+checked*/
+void *rbBenchTopDownWriter(void *arg) {
+    RBBenchThread *thread = arg;
+    RBTNode *node;
+    uint64_t random;
+    int key;
+    while (!atomic_load_explicit(thread->stop, memory_order_relaxed)) {
+        random = rbRandom(&(thread->seed));
+        key = (int)((random >> 1) % (uint64_t)(2 * thread->n));
+        if (thread->lock != NULL) {
+            pthread_mutex_lock(thread->lock);
+        }
+        if (thread->topDown != NULL) {
+            thread->hits += (random & 1) ? rbtdInsert(thread->topDown, key) : -rbtdDelete(thread->topDown, key);
+        } else {
+            node = rbIterativeTreeSearch(thread->rbTree, thread->rbTree->root, key);
+            if ((random & 1) && node == thread->rbTree->nil) {
+                rbTreeInsert(thread->rbTree, rbNodeAlloc(thread->rbTree, key));
+                thread->hits++;
+            } else if (!(random & 1) && node != thread->rbTree->nil) {
+                treeDelete(thread->rbTree, node);
+                rbNodeFree(thread->rbTree, node);
+                thread->hits--;
+            }
+        }
+        if (thread->lock != NULL) {
+            pthread_mutex_unlock(thread->lock);
+        }
+        thread->ops++;
+    }
+    return NULL;
+}
+
+#if RB_INTERVALS
+#define RB_BENCH_WINDOWS 1000 //Queries of the linear scan, which costs O(n) each. The tree answers RB_BENCH_LOOKUPS
+
+/*Store n time windows with random starts and lengths, then answer random overlap queries both with the interval tree
+and with a linear scan over the windows. "any" stops at the first overlapping window, "all" counts every one. The
+counts of the two methods on the shared queries must agree*/
+void rbBenchIntervals(int n) {
+    RBTree *rbTree;
+    uint64_t state = 88172645463325252ULL;
+    int *lows, *highs, *queries;
+    int i, j, span = 100 * n, hits, linearHits, total, linearTotal, count = 0;
+    double start, any, all, linearAny, linearAll;
+
+    lows = malloc(n * sizeof(int));
+    highs = malloc(n * sizeof(int));
+    queries = malloc(RB_BENCH_LOOKUPS * sizeof(int));
+    rbTree = rbTreeCreate();
+    for (i = 0; i < n; i++) {
+        lows[i] = (int)(rbRandom(&state) % (uint64_t)span);
+        highs[i] = lows[i] + (int)(rbRandom(&state) % 1000);
+        rbIntervalInsert(rbTree, lows[i], highs[i]);
+    }
+    //Each query is the window [q, q + 100]
+    for (i = 0; i < RB_BENCH_LOOKUPS; i++) {
+        queries[i] = (int)(rbRandom(&state) % (uint64_t)span);
+    }
+
+    start = rbNow();
+    for (i = 0, hits = 0; i < RB_BENCH_LOOKUPS; i++) {
+        hits += rbIntervalSearch(rbTree, queries[i], queries[i] + 100) != rbTree->nil;
+    }
+    any = RB_BENCH_LOOKUPS / (rbNow() - start);
+    start = rbNow();
+    for (i = 0, total = 0; i < RB_BENCH_LOOKUPS; i++) {
+        total += rbIntervalScan(rbTree, queries[i], queries[i] + 100, rbBenchCountInterval, &count);
+    }
+    all = RB_BENCH_LOOKUPS / (rbNow() - start);
+
+    start = rbNow();
+    for (i = 0, linearHits = 0; i < RB_BENCH_WINDOWS; i++) {
+        for (j = 0; j < n && (lows[j] > queries[i] + 100 || highs[j] < queries[i]); j++) {
+        }
+        linearHits += j < n;
+    }
+    linearAny = RB_BENCH_WINDOWS / (rbNow() - start);
+    start = rbNow();
+    for (i = 0, linearTotal = 0; i < RB_BENCH_WINDOWS; i++) {
+        for (j = 0; j < n; j++) {
+            linearTotal += lows[j] <= queries[i] + 100 && highs[j] >= queries[i];
+        }
+    }
+    linearAll = RB_BENCH_WINDOWS / (rbNow() - start);
+    //Recount the queries the linear scan answered to check both methods against each other
+    for (i = 0, hits = 0, total = 0; i < RB_BENCH_WINDOWS; i++) {
+        hits += rbIntervalSearch(rbTree, queries[i], queries[i] + 100) != rbTree->nil;
+        total += rbIntervalScan(rbTree, queries[i], queries[i] + 100, rbBenchCountInterval, &count);
+    }
+    if (hits != linearHits || total != linearTotal) {
+        fprintf(stderr, "intervals: tree found %d/%d, linear scan %d/%d\n", hits, total, linearHits, linearTotal);
+    }
+    printf("{\"bench\":\"intervals\",\"query\":\"any\",\"n\":%d,\"tree_queries_per_sec\":%.0f,"
+        "\"linear_queries_per_sec\":%.0f,\"speedup\":%.0f}\n", n, any, linearAny, any / linearAny);
+    printf("{\"bench\":\"intervals\",\"query\":\"all\",\"n\":%d,\"tree_queries_per_sec\":%.0f,"
+        "\"linear_queries_per_sec\":%.0f,\"speedup\":%.0f,\"matches_per_query\":%.2f}\n", n, all, linearAll,
+        all / linearAll, (double)linearTotal / RB_BENCH_WINDOWS);
+
+    free(lows);
+    free(highs);
+    free(queries);
+    rbTreeDestroy(rbTree);
+    return;
+}
+
+/*Interval scan visitor that only counts*/
+int rbBenchCountInterval(int low, int high, void *count) {
+    (void)low;
+    (void)high;
+    (*(int *)count)++;
+    return 0;
+}
+#endif